@@ -0,0 +1,63 @@
+// Symbol lookup in a single frame holding 10, 100 and 10k bindings,
+// with and without the frame's hash index.
+#include "../core.c"
+
+#define LOOKUPS 10000000
+
+double bench_lookups(ideenv* env, ideobj** keys, int count) {
+    clock_t start = clock();
+    long found = 0;
+
+    for (long i=0; i<LOOKUPS; i++) {
+        ideobj* val = ideenv_get(env, keys[(i * 7919) % count]);
+        found += val->num;
+        ideobj_del(val);
+    }
+
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    if (found < 0) {
+        printf("unreachable\n");
+    }
+    return elapsed * 1e9 / LOOKUPS;
+}
+
+int main(void) {
+    int sizes[] = { 10, 100, 10000 };
+
+    for (int s=0; s<3; s++) {
+        int count = sizes[s];
+        ideenv* env = ideenv_new();
+        ideobj** keys = malloc(sizeof(ideobj*) * count);
+
+        for (int i=0; i<count; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "binding-%d", i);
+            keys[i] = ideobj_symbol(name);
+
+            ideobj* val = ideobj_num(i);
+            ideenv_put(env, keys[i], val);
+            ideobj_del(val);
+        }
+
+        double hashed = bench_lookups(env, keys, count);
+
+        // Dropping the index falls back to the linear scan
+        int* index = env->index;
+        env->index = NULL;
+        double linear = bench_lookups(env, keys, count);
+        env->index = index;
+
+        printf(
+            "%5d bindings: %6.1f ns hashed, %8.1f ns linear\n",
+            count, hashed, linear
+        );
+
+        for (int i=0; i<count; i++) {
+            ideobj_del(keys[i]);
+        }
+        free(keys);
+        ideenv_del(env);
+    }
+
+    return 0;
+}
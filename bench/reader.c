@@ -0,0 +1,220 @@
+// Reader throughput in MB/s over the standard library and test suite
+// repeated to a few megabytes, against parsing the same source with the
+// mpc grammar and converting its AST.
+#include "../core.c"
+
+#define SOURCE_SIZE (8 << 20)
+#define ROUNDS 5
+
+mpc_parser_t* Decimal;
+mpc_parser_t* Number;
+mpc_parser_t* String;
+mpc_parser_t* Symbol;
+mpc_parser_t* Comment;
+mpc_parser_t* HashMap;
+mpc_parser_t* Keyword;
+mpc_parser_t* Sexpr;
+mpc_parser_t* Qexpr;
+mpc_parser_t* Expr;
+mpc_parser_t* IdeLISP;
+
+ideobj* mpc_read(mpc_ast_t* node) {
+    if (strstr(node->tag, "decimal")) {
+        return ideobj_decimal(strtod(node->contents, NULL));
+    }
+    if (strstr(node->tag, "number")) {
+        return ideobj_num(strtol(node->contents, NULL, 10));
+    }
+    if (strstr(node->tag, "string")) {
+        node->contents[strlen(node->contents)-1] = '\0';
+        char* unescaped = malloc(strlen(node->contents+1)+1);
+        strcpy(unescaped, node->contents+1);
+        unescaped = mpcf_unescape(unescaped);
+        ideobj* obj = ideobj_str(unescaped);
+        free(unescaped);
+        return obj;
+    }
+    if (strstr(node->tag, "keyword")) {
+        return ideobj_keyword(node->contents+1);
+    }
+    if (strstr(node->tag, "symbol")) {
+        return ideobj_symbol(node->contents);
+    }
+
+    ideobj* list;
+    if (strstr(node->tag, "qexpr")) {
+        list = ideobj_qexpr();
+    } else if (strstr(node->tag, "hashmap")) {
+        list = ideobj_hashmap();
+    } else {
+        list = ideobj_sexpr();
+    }
+
+    ideobj* key = NULL;
+    for (int i=0; i<node->children_num; i++) {
+        mpc_ast_t* child = node->children[i];
+        if (
+            strstr(child->tag, "comment") ||
+            strcmp(child->tag, "regex") == 0 ||
+            strcmp(child->contents, "(") == 0 ||
+            strcmp(child->contents, "'(") == 0 ||
+            strcmp(child->contents, ")") == 0 ||
+            strcmp(child->contents, "{") == 0 ||
+            strcmp(child->contents, "}") == 0
+        ) {
+            continue;
+        }
+
+        ideobj* value = mpc_read(child);
+        if (list->type != IDEOBJ_HASHMAP) {
+            list = ideobj_list_add(list, value);
+        } else if (!key) {
+            key = value;
+        } else {
+            list = ideobj_hashmap_add(list, key, value);
+            key = NULL;
+        }
+    }
+    return list;
+}
+
+ideobj* read_mpc(char* source) {
+    mpc_result_t result;
+    if (!mpc_parse("bench", source, IdeLISP, &result)) {
+        mpc_err_print(result.error);
+        mpc_err_delete(result.error);
+        exit(1);
+    }
+    ideobj* expressions = mpc_read(result.output);
+    mpc_ast_delete(result.output);
+    return expressions;
+}
+
+ideobj* read_direct(char* source) {
+    ideobj* expressions = ideobj_read("bench", source);
+    if (expressions->type == IDEOBJ_ERR) {
+        ideobj_println(expressions);
+        exit(1);
+    }
+    return expressions;
+}
+
+char* read_file(char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = malloc(size + 1);
+    source[fread(source, 1, size, file)] = '\0';
+    fclose(file);
+    return source;
+}
+
+double bench_reader(ideobj* (*read)(char*), char* source, long size) {
+    clock_t start = clock();
+    for (int i=0; i<ROUNDS; i++) {
+        ideobj_del(read(source));
+    }
+    double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    return (double) size * ROUNDS / elapsed / (1 << 20);
+}
+
+int main(void) {
+    Decimal = mpc_new("decimal");
+    Number = mpc_new("number");
+    String = mpc_new("string");
+    Symbol = mpc_new("symbol");
+    Keyword = mpc_new("keyword");
+    Comment = mpc_new("comment");
+    HashMap = mpc_new("hashmap");
+    Sexpr = mpc_new("sexpr");
+    Qexpr = mpc_new("qexpr");
+    Expr = mpc_new("expr");
+    IdeLISP = mpc_new("idelisp");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+        "                                                                     \
+            decimal  : /-?[0-9]+\\.[0-9]+/ ;                                  \
+            number   : /-?[0-9]+/ ;                                           \
+            string   : /\"(\\\\.|[^\"])*\"/ ;                                 \
+            keyword  : /:[a-zA-Z0-9_+^\\-*\\/\\\\=<>!&%\\?]+/ ;               \
+            symbol   : /[a-zA-Z0-9_+^\\-*\\/\\\\=<>!&%\\?]+/ ;                \
+            comment  : /;[^\\r\\n]*/ ;                                        \
+            hashmap  : '{' <expr>* '}' ;                                      \
+            sexpr    : '(' <expr>* ')' ;                                      \
+            qexpr    : \"'(\" <expr>* ')' ;                                   \
+            expr     : <decimal> | <number> | <string> | <keyword> | <symbol> \
+                     | <sexpr> | <qexpr> | <comment> | <hashmap> ;            \
+            idelisp  : /^/ <expr>* /$/ ;                                      \
+        ",
+        Decimal,
+        Number,
+        String,
+        Keyword,
+        Symbol,
+        Comment,
+        HashMap,
+        Sexpr,
+        Qexpr,
+        Expr,
+        IdeLISP);
+
+    char* files[] = { read_file("standard.ilisp"), read_file("tests.ilisp") };
+    if (!files[0] || !files[1]) {
+        printf("Run from the project root\n");
+        return 1;
+    }
+
+    char* source = malloc(SOURCE_SIZE + 1);
+    long size = 0;
+    for (int i=0; ; i = !i) {
+        long length = strlen(files[i]);
+        if (size + length + 1 > SOURCE_SIZE) {
+            break;
+        }
+        memcpy(source + size, files[i], length);
+        size += length;
+        source[size++] = '\n';
+    }
+    source[size] = '\0';
+
+    // Both must read the same expressions before their speeds mean anything
+    ideobj* mpc_result = read_mpc(source);
+    ideobj* direct_result = read_direct(source);
+    if (!ideobj_eq(mpc_result, direct_result)) {
+        printf("Readers disagree\n");
+        return 1;
+    }
+    ideobj_del(mpc_result);
+    ideobj_del(direct_result);
+
+    double direct = bench_reader(read_direct, source, size);
+    double mpc = bench_reader(read_mpc, source, size);
+    printf(
+        "%.1f MB: %7.1f MB/s direct, %6.1f MB/s mpc\n",
+        (double) size / (1 << 20), direct, mpc
+    );
+
+    free(source);
+    free(files[0]);
+    free(files[1]);
+    mpc_cleanup(
+        11,
+        Decimal,
+        Number,
+        String,
+        Keyword,
+        Symbol,
+        Comment,
+        HashMap,
+        Sexpr,
+        Qexpr,
+        Expr,
+        IdeLISP
+    );
+    return 0;
+}
@@ -1,5 +1,12 @@
+// realpath, for the canonical paths of loaded modules
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 #include "mpc.h"
 
 enum {
@@ -13,65 +20,500 @@ enum {
     IDEOBJ_FUN,
     IDEOBJ_STR,
     IDEOBJ_HASHMAP,
-    IDEOBJ_KEYWORD
+    IDEOBJ_KEYWORD,
+    IDEOBJ_SEQ
 };
 
+// Lexical address depths that do not name a frame
+#define IDEADDR_NONE -1
+#define IDEADDR_GLOBAL -2
+
 
 struct ideobj;
 struct ideenv;
+struct ideseq;
 typedef struct ideobj ideobj;
 typedef struct ideenv ideenv;
+typedef struct ideseq ideseq;
 
 typedef ideobj*(*ibuiltin)(ideenv*, ideobj*);
 
+// Only the members belonging to `type` are valid, numbers and decimals
+// are stored inline in the union instead of behind a pointer. Objects are
+// shared through `rc`, use ideobj_cow before modifying one in place.
+// Symbol and keyword names point into the intern table.
 struct ideobj {
-    int type;
-
-    long num;
-    double decimal;
-    char* err;
-    char* symbol;
-    char* keyword;
-    char* str;
-    ibuiltin builtin;
+    unsigned char type;
+    unsigned char marked;
+
+    // Set on lists whose buffer holds compiled code, see idevm_code
+    unsigned char compiled;
+    int rc;
+
+    union {
+        long num;
+        double decimal;
+        char* err;
+        char* keyword;
+
+        // IDEOBJ_SYMBOL, with its lexical address, see ideenv_lookup
+        struct {
+            char* symbol;
+            int depth;
+            int slot;
+        };
+
+        char* str;
+
+        // IDEOBJ_BUILTIN, with the operator it applies, see idearith_call,
+        // and the special form it implements, see ideform_called
+        struct {
+            ibuiltin builtin;
+            int arith;
+            int form;
+        };
+
+        // IDEOBJ_FUN
+        struct {
+            ideenv* env;
+            ideobj* params;
+            ideobj* body;
+        };
+
+        // IDEOBJ_SEXPR and IDEOBJ_QEXPR. Cells start `offset` slots into
+        // their buffer, see idelist_reserve. A list with a `base` owns no
+        // buffer and views the cells of base instead, see idelist_view
+        struct {
+            int count;
+            int offset;
+            struct ideobj** cell;
+            struct ideobj* base;
+        };
+
+        // IDEOBJ_HASHMAP, a trie of entries shared between copies, see
+        // ideobj_hashmap_add. `stamp` numbers the next new entry.
+        struct {
+            int size;
+            long stamp;
+            struct idenode* root;
+        };
+
+        // IDEOBJ_SEQ, kept out of line to leave the union small
+        ideseq* seq;
+
+        // A freed slot of a promoted block, see ideobj_free
+        struct ideobj* next_free;
+    };
+};
 
-    ideenv* env;
-    ideobj* params;
-    ideobj* body;
+// Lazy sequences are a chain of stages, each reading its elements from
+// `source` as they are asked for, see idecursor_next. Ranges start the
+// chain and count from `from` up to `to`. Take and drop keep their count
+// in `to`, the stages calling a function keep it in `fn`.
+enum {
+    IDESEQ_RANGE,
+    IDESEQ_MAP,
+    IDESEQ_FILTER,
+    IDESEQ_TAKE_WHILE,
+    IDESEQ_TAKE,
+    IDESEQ_DROP
+};
 
-    int count;
-    struct ideobj** cell;
-    struct ideobj** keys;
+struct ideseq {
+    int stage;
+    long from;
+    long to;
+    long step;
+    ideobj* fn;
+    ideobj* source;
 };
 
 struct ideenv {
+    int rc;
     ideenv* parent;
+
+    // The env a call frame was called from, see ideenv_get
+    ideenv* caller;
+
     int count;
+    int capacity;
     char** symbols;
     ideobj** values;
     int depth;
+
+    // Frames past IDEENV_HASH_THRESHOLD bindings index their slots by
+    // symbol, see ideenv_find
+    int* index;
+    int index_capacity;
+
+    // Every env is linked into the gc heap, see idegc_collect
+    int marked;
+    ideenv* gc_prev;
+    ideenv* gc_next;
 };
 
-mpc_parser_t* Decimal;
-mpc_parser_t* Number;
-mpc_parser_t* String;
-mpc_parser_t* Symbol;
-mpc_parser_t* Comment;
-mpc_parser_t* HashMap;
-mpc_parser_t* Keyword;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* IdeLISP;
+// Fixed size slab allocator, one per type. Released objects are kept on
+// an intrusive free list and handed out again before new slab memory is
+// carved. Build with -DIDE_USE_MALLOC to use plain malloc/free (ASan).
+#define IDESLAB_BLOCK_SIZE 512
+
+typedef struct ideslab {
+    size_t size;
+    void* free_list;
+    char* next;
+    char* end;
+    long allocs;
+    long hits;
+    long frees;
+    long blocks;
+} ideslab;
+
+ideslab ideobj_slab = { sizeof(ideobj) };
+ideslab ideenv_slab = { sizeof(ideenv) };
+
+void* ideslab_alloc(ideslab* slab) {
+    slab->allocs++;
+
+#ifdef IDE_USE_MALLOC
+    return malloc(slab->size);
+#else
+    if (slab->free_list) {
+        void* ptr = slab->free_list;
+        slab->free_list = *(void**) ptr;
+        slab->hits++;
+        return ptr;
+    }
+
+    if (slab->next == slab->end) {
+        slab->next = malloc(slab->size * IDESLAB_BLOCK_SIZE);
+        slab->end = slab->next + slab->size * IDESLAB_BLOCK_SIZE;
+        slab->blocks++;
+    }
+
+    void* ptr = slab->next;
+    slab->next += slab->size;
+    return ptr;
+#endif
+}
+
+void ideslab_free(ideslab* slab, void* ptr) {
+    slab->frees++;
+
+#ifdef IDE_USE_MALLOC
+    free(ptr);
+#else
+    *(void**) ptr = slab->free_list;
+    slab->free_list = ptr;
+#endif
+}
+
+// New objects are bump allocated from the nursery block. Temporaries
+// mostly die in the reverse order they were made, so freeing the top
+// object moves the bump pointer back down over every dead slot. Objects
+// can not move, so once the nursery is full its block is promoted in
+// place and a new nursery is started. Slots freed in a promoted block go
+// on that block's free list and are handed out before the nursery is
+// bumped, so a few survivors do not pin the rest of their block. Each
+// block counts its live objects and goes back to the pool of empty blocks
+// when the count drops to zero.
+#define IDEBLOCK_SIZE (8 * 1024)
+#define IDEBLOCK_POOL_MAX 64
+#define IDEOBJ_FREED 0xff
+
+// `next` links pooled blocks, and with `prev` the promoted blocks that
+// have free slots
+typedef struct ideblock {
+    long live;
+    ideobj* free;
+    struct ideblock* next;
+    struct ideblock* prev;
+} ideblock;
+
+_Static_assert(
+    sizeof(ideblock) <= sizeof(ideobj), "Block header must fit in a slot"
+);
+
+#define IDEBLOCK_OF(obj) \
+    ((ideblock*) ((uintptr_t) (obj) & ~(uintptr_t) (IDEBLOCK_SIZE - 1)))
+
+typedef struct idenursery {
+    ideblock* block;
+    ideobj* start;
+    ideobj* next;
+    ideobj* end;
+    // Highest the bump pointer has been in this block, slots below it
+    // are being reused
+    ideobj* top;
+    ideblock* partial;
+    ideblock* pool;
+    int pool_count;
+    long bumps;
+    long promotions;
+    long survivors;
+    long recycled;
+} idenursery;
+
+idenursery nursery;
+
+void idenursery_link(ideblock* block) {
+    block->prev = NULL;
+    block->next = nursery.partial;
+    if (nursery.partial) {
+        nursery.partial->prev = block;
+    }
+    nursery.partial = block;
+}
+
+void idenursery_unlink(ideblock* block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        nursery.partial = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+}
+
+void idenursery_refill(void) {
+    ideblock* promoted = nursery.block;
+    if (promoted) {
+        nursery.promotions++;
+        nursery.survivors += promoted->live;
+
+        // Slots that died below the top were never reclaimed by the bump
+        // pointer, so they start the promoted block's free list
+        promoted->free = NULL;
+        for (ideobj* slot = nursery.start; slot < nursery.next; slot++) {
+            if (slot->type == IDEOBJ_FREED) {
+                slot->next_free = promoted->free;
+                promoted->free = slot;
+            }
+        }
+        if (promoted->free) {
+            idenursery_link(promoted);
+        }
+    }
+
+    ideblock* block = nursery.pool;
+    if (block) {
+        nursery.pool = block->next;
+        nursery.pool_count--;
+        nursery.recycled++;
+    } else {
+        block = aligned_alloc(IDEBLOCK_SIZE, IDEBLOCK_SIZE);
+        ideobj_slab.blocks++;
+    }
+
+    block->live = 0;
+    block->free = NULL;
+    nursery.block = block;
+    // The first slot is taken by the block header
+    nursery.start = (ideobj*) block + 1;
+    nursery.next = nursery.start;
+    nursery.top = nursery.start;
+    nursery.end = (ideobj*) ((char*) block + IDEBLOCK_SIZE);
+}
+
+ideobj* ideobj_alloc(void) {
+#ifdef IDE_USE_MALLOC
+    return ideslab_alloc(&ideobj_slab);
+#else
+    ideobj_slab.allocs++;
+
+    ideblock* partial = nursery.partial;
+    if (partial) {
+        ideobj* obj = partial->free;
+        partial->free = obj->next_free;
+        if (!partial->free) {
+            idenursery_unlink(partial);
+        }
+        partial->live++;
+        ideobj_slab.hits++;
+        return obj;
+    }
+
+    if (nursery.next == nursery.end) {
+        idenursery_refill();
+    }
+
+    if (nursery.next < nursery.top) {
+        ideobj_slab.hits++;
+    }
+    nursery.bumps++;
+    nursery.block->live++;
+    return nursery.next++;
+#endif
+}
+
+void ideobj_free(ideobj* obj) {
+#ifdef IDE_USE_MALLOC
+    ideslab_free(&ideobj_slab, obj);
+#else
+    ideblock* block = IDEBLOCK_OF(obj);
+
+    ideobj_slab.frees++;
+    obj->type = IDEOBJ_FREED;
+    block->live--;
+
+    if (block == nursery.block) {
+        if (nursery.next > nursery.top) {
+            nursery.top = nursery.next;
+        }
+        while (
+            nursery.next > nursery.start &&
+            nursery.next[-1].type == IDEOBJ_FREED
+        ) {
+            nursery.next--;
+        }
+        return;
+    }
+
+    if (block->live == 0) {
+        if (block->free) {
+            idenursery_unlink(block);
+        }
+        if (nursery.pool_count == IDEBLOCK_POOL_MAX) {
+            free(block);
+            return;
+        }
+
+        block->next = nursery.pool;
+        nursery.pool = block;
+        nursery.pool_count++;
+        return;
+    }
+
+    if (!block->free) {
+        idenursery_link(block);
+    }
+    obj->next_free = block->free;
+    block->free = obj;
+#endif
+}
+
+// Reference counts free everything except cycles, which can only form
+// through environments (an env holding a closure defined in that env).
+// These are reclaimed by a mark-and-sweep collector that runs at safe
+// points between top-level expressions and at calls. Its roots are the
+// envs on the evaluator stack and the frames and values of the machine.
+// Builtins and evaluations in progress can hold more on the C stack,
+// which is found from reference counts instead, see idegc_mark_held.
+#define IDEGC_MIN_THRESHOLD 1024
+
+typedef struct idegc {
+    ideenv* heap;
+    ideenv** stack;
+    int stack_count;
+    int stack_capacity;
+    int depth;
+    // Envs in the heap. Most are released by their reference counts, so
+    // collections are started by the heap growing, not by allocating.
+    long count;
+    long threshold;
+    long collections;
+    long freed;
+    double pause_total;
+    double pause_max;
+} idegc;
+
+idegc gc = { .threshold = IDEGC_MIN_THRESHOLD };
+
+// Symbol and keyword names are interned, every distinct name is stored
+// once for the lifetime of the process. Two names are equal exactly when
+// their pointers are, and objects and environments share the interned
+// string instead of owning a copy.
+#define IDEINTERN_MIN_CAPACITY 256
+
+// Each name is stored in an atom, which also counts the env bindings
+// using it across all environments
+typedef struct ideatom {
+    long binds;
+    char name[];
+} ideatom;
+
+#define IDEATOM_OF(str) ((ideatom*) ((str) - offsetof(ideatom, name)))
+
+typedef struct ideintern_table {
+    char** names;
+    long count;
+    long capacity;
+} ideintern_table;
+
+ideintern_table interned;
+
+unsigned long idehash_str(char* str) {
+    unsigned long hash = 14695981039346656037UL;
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+void ideintern_insert(char** names, long capacity, char* name) {
+    unsigned long i = idehash_str(name) & (capacity - 1);
+    while (names[i]) {
+        i = (i + 1) & (capacity - 1);
+    }
+    names[i] = name;
+}
+
+void ideintern_grow(void) {
+    long capacity = interned.capacity
+        ? interned.capacity * 2
+        : IDEINTERN_MIN_CAPACITY;
+    char** names = calloc(capacity, sizeof(char*));
+
+    for (long i=0; i<interned.capacity; i++) {
+        if (interned.names[i]) {
+            ideintern_insert(names, capacity, interned.names[i]);
+        }
+    }
+
+    free(interned.names);
+    interned.names = names;
+    interned.capacity = capacity;
+}
+
+char* ideintern(char* name) {
+    // Keep the table at most half full so probe runs stay short
+    if ((interned.count + 1) * 2 > interned.capacity) {
+        ideintern_grow();
+    }
+
+    unsigned long i = idehash_str(name) & (interned.capacity - 1);
+    while (interned.names[i]) {
+        if (strcmp(interned.names[i], name) == 0) {
+            return interned.names[i];
+        }
+        i = (i + 1) & (interned.capacity - 1);
+    }
+
+    ideatom* atom = malloc(sizeof(ideatom) + strlen(name) + 1);
+    atom->binds = 0;
+    strcpy(atom->name, name);
 
+    interned.names[i] = atom->name;
+    interned.count++;
+    return interned.names[i];
+}
 
 ideenv* ideenv_new(void);            // Forward declaration
 ideenv* ideenv_new_enclosed(ideenv* env);       // Forward declaration
 
+ideobj* ideobj_new(int type) {
+    ideobj* obj = ideobj_alloc();
+    obj->type = type;
+    obj->compiled = 0;
+    obj->marked = 0;
+    obj->rc = 1;
+    return obj;
+}
+
 
 ideobj* ideobj_err(char* format, ...) {
-    ideobj* obj = malloc(sizeof(ideobj));
-    obj->type = IDEOBJ_ERR;
+    ideobj* obj = ideobj_new(IDEOBJ_ERR);
 
     va_list value_list;
     va_start(value_list, format);
@@ -86,60 +528,56 @@ ideobj* ideobj_err(char* format, ...) {
 }
 
 ideobj* ideobj_num(long val) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_NUM;
+    ideobj* obj = ideobj_new(IDEOBJ_NUM);
     obj->num = val;
     return obj;
 }
 
 ideobj* ideobj_decimal(double val) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_DECIMAL;
+    ideobj* obj = ideobj_new(IDEOBJ_DECIMAL);
     obj->decimal = val;
     return obj;
 }
 
 ideobj* ideobj_symbol(char* symbol) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_SYMBOL;
-    obj->symbol = malloc(strlen(symbol) + 1);
-    strcpy(obj->symbol, symbol);
+    ideobj* obj = ideobj_new(IDEOBJ_SYMBOL);
+    obj->symbol = ideintern(symbol);
+    obj->depth = IDEADDR_NONE;
+    obj->slot = -1;
     return obj;
 }
 
 ideobj* ideobj_sexpr(void) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_SEXPR;
+    ideobj* obj = ideobj_new(IDEOBJ_SEXPR);
     obj->count = 0;
+    obj->offset = 0;
     obj->cell = NULL;
+    obj->base = NULL;
     return obj;
 }
 
 ideobj* ideobj_qexpr(void) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_QEXPR;
+    ideobj* obj = ideobj_new(IDEOBJ_QEXPR);
     obj->count = 0;
+    obj->offset = 0;
     obj->cell = NULL;
+    obj->base = NULL;
     return obj;
 }
 
-ideobj* ideobj_builtin(ibuiltin builtin) {
-    ideobj* obj = malloc(sizeof(ideobj));
+int idearith_of(ibuiltin builtin);
+int ideform_of(ibuiltin builtin);
 
-    obj->type = IDEOBJ_BUILTIN;
+ideobj* ideobj_builtin(ibuiltin builtin) {
+    ideobj* obj = ideobj_new(IDEOBJ_BUILTIN);
     obj->builtin = builtin;
+    obj->arith = idearith_of(builtin);
+    obj->form = ideform_of(builtin);
     return obj;
 }
 
 ideobj* ideobj_fun(ideobj* params, ideobj* body) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_FUN;
+    ideobj* obj = ideobj_new(IDEOBJ_FUN);
     obj->env = ideenv_new();
     obj->params = params;
     obj->body = body;
@@ -147,30 +585,35 @@ ideobj* ideobj_fun(ideobj* params, ideobj* body) {
 }
 
 ideobj* ideobj_str(char* str) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_STR;
+    ideobj* obj = ideobj_new(IDEOBJ_STR);
     obj->str = malloc(strlen(str) + 1);
     strcpy(obj->str, str);
     return obj;
 }
 
 ideobj* ideobj_keyword(char* keyword) {
-    ideobj* obj = malloc(sizeof(ideobj));
-
-    obj->type = IDEOBJ_KEYWORD;
-    obj->keyword = malloc(strlen(keyword) + 1);
-    strcpy(obj->keyword, keyword);
+    ideobj* obj = ideobj_new(IDEOBJ_KEYWORD);
+    obj->keyword = ideintern(keyword);
     return obj;
 }
 
 ideobj* ideobj_hashmap(void) {
-    ideobj* obj = malloc(sizeof(ideobj));
+    ideobj* obj = ideobj_new(IDEOBJ_HASHMAP);
+    obj->size = 0;
+    obj->stamp = 0;
+    obj->root = NULL;
+    return obj;
+}
 
-    obj->type = IDEOBJ_HASHMAP;
-    obj->count = 0;
-    obj->keys = NULL;
-    obj->cell = NULL;
+ideobj* ideobj_seq(int stage, ideobj* fn, ideobj* source) {
+    ideobj* obj = ideobj_new(IDEOBJ_SEQ);
+    obj->seq = malloc(sizeof(ideseq));
+    obj->seq->stage = stage;
+    obj->seq->from = 0;
+    obj->seq->to = 0;
+    obj->seq->step = 1;
+    obj->seq->fn = fn;
+    obj->seq->source = source;
     return obj;
 }
 
@@ -187,99 +630,444 @@ char* idetype_name(int type) {
         case IDEOBJ_STR: return "String";
         case IDEOBJ_KEYWORD: return "Keyword";
         case IDEOBJ_HASHMAP: return "HashMap";
+        case IDEOBJ_SEQ: return "Sequence";
         default: return "Unknown";
     }
 }
 
+// List cells live in a buffer with spare capacity at the end. Popping
+// the first cell only moves `cell` one slot further into the buffer, the
+// space in front is reclaimed when the list next runs out of room. A
+// buffer also keeps the bytecode compiled from its cells, see idevm_code.
+#define IDELIST_MIN_CAPACITY 4
+
+struct idecode;
+void idecode_free(struct idecode* code);
+
+typedef struct idecells {
+    int capacity;
+    struct idecode* code;
+    ideobj* cells[];
+} idecells;
+
+idecells* idelist_buffer(ideobj* obj) {
+    if (!obj->cell) {
+        return NULL;
+    }
+    return (idecells*) ((char*) (obj->cell - obj->offset) - offsetof(idecells, cells));
+}
+
+void idelist_free(ideobj* obj) {
+    idecells* buffer = idelist_buffer(obj);
+    if (buffer && buffer->code) {
+        idecode_free(buffer->code);
+    }
+    free(buffer);
+}
+
+// Drops the code compiled from the cells of obj before they change
+void idelist_changed(ideobj* obj) {
+    if (obj->compiled) {
+        idecells* buffer = idelist_buffer(obj);
+        idecode_free(buffer->code);
+        buffer->code = NULL;
+        obj->compiled = 0;
+    }
+}
+
+void idelist_unview(ideobj* obj);
+
+// Makes room for at least `count` cells
+void idelist_reserve(ideobj* obj, int count) {
+    if (obj->base) {
+        idelist_unview(obj);
+    }
+    idelist_changed(obj);
+
+    idecells* buffer = idelist_buffer(obj);
+    int capacity = buffer ? buffer->capacity : 0;
+
+    if (obj->offset + count <= capacity) {
+        return;
+    }
+
+    // Sliding back only once half the buffer is free in front keeps
+    // alternating pops and appends amortized O(1)
+    if (count <= capacity && obj->offset >= capacity / 2) {
+        memmove(buffer->cells, obj->cell, sizeof(ideobj*) * obj->count);
+        obj->cell = buffer->cells;
+        obj->offset = 0;
+        return;
+    }
+
+    int grown = capacity ? capacity * 2 : IDELIST_MIN_CAPACITY;
+    while (grown < count) {
+        grown *= 2;
+    }
+
+    idecells* resized = malloc(sizeof(idecells) + sizeof(ideobj*) * grown);
+    resized->capacity = grown;
+    resized->code = NULL;
+    if (obj->count) {
+        memcpy(resized->cells, obj->cell, sizeof(ideobj*) * obj->count);
+    }
+
+    free(buffer);
+    obj->cell = resized->cells;
+    obj->offset = 0;
+}
+
+// Makes room for `count` more cells in front of the first one. The free
+// space in front grows with the list, so repeatedly prepending is
+// amortized O(1) per cell.
+void idelist_reserve_front(ideobj* obj, int count) {
+    if (obj->base) {
+        idelist_unview(obj);
+    }
+    idelist_changed(obj);
+
+    if (obj->offset >= count) {
+        return;
+    }
+
+    int front = count > obj->count ? count : obj->count;
+    int grown = IDELIST_MIN_CAPACITY;
+    while (grown < front + obj->count) {
+        grown *= 2;
+    }
+
+    idecells* resized = malloc(sizeof(idecells) + sizeof(ideobj*) * grown);
+    resized->capacity = grown;
+    resized->code = NULL;
+    if (obj->count) {
+        memcpy(resized->cells + front, obj->cell, sizeof(ideobj*) * obj->count);
+    }
+
+    idelist_free(obj);
+    obj->cell = resized->cells + front;
+    obj->offset = front;
+}
+
+ideobj* ideobj_copy(ideobj* obj);
+void ideobj_del(ideobj* obj);
+
+// Returns `count` cells of list starting at `first` as a new list that
+// shares them instead of copying, and releases list. Views are read only,
+// they get their own copy of their cells once modified, see ideobj_cow.
+ideobj* idelist_view(ideobj* list, int first, int count) {
+    ideobj* view = ideobj_new(list->type);
+    view->count = count;
+    view->offset = 0;
+    view->cell = list->cell + first;
+    view->base = ideobj_copy(list->base ? list->base : list);
+    ideobj_del(list);
+    return view;
+}
+
+void idelist_unview(ideobj* obj) {
+    ideobj* base = obj->base;
+    ideobj** cells = obj->cell;
+    int count = obj->count;
+
+    obj->base = NULL;
+    obj->cell = NULL;
+    obj->offset = 0;
+    obj->count = 0;
+    idelist_reserve(obj, count);
+
+    for (int i=0; i<count; i++) {
+        obj->cell[i] = ideobj_copy(cells[i]);
+    }
+    obj->count = count;
+    ideobj_del(base);
+}
+
+// Hash maps are hash array mapped tries. A node has 32 slots, picked by
+// five bits of the key hash per level, and only stores the ones in use,
+// as marked in `bitmap`. A slot holds an entry, or a child node when its
+// key is NULL. Keys with the same full hash share a collision node, which
+// is searched linearly. Nodes are refcounted and shared between maps, so
+// an update only copies the nodes on its path, see idenode_own.
+#define IDENODE_BITS 5
+#define IDENODE_MASK 31
+
+typedef struct ideslot {
+    ideobj* key;
+    union {
+        ideobj* val;
+        struct idenode* node;
+    };
+    unsigned long hash;
+
+    // Entries are listed in the order they were added, see idemap_ordered
+    long stamp;
+} ideslot;
+
+typedef struct idenode {
+    int rc;
+    int count;
+    int collision;
+    unsigned int bitmap;
+    ideslot slots[];
+} idenode;
+
+idenode* idenode_new(int count, int collision) {
+    idenode* node = malloc(sizeof(idenode) + sizeof(ideslot) * count);
+    node->rc = 1;
+    node->count = count;
+    node->collision = collision;
+    node->bitmap = 0;
+    return node;
+}
+
+void idenode_del(idenode* node) {
+    if (--node->rc > 0) {
+        return;
+    }
+
+    for (int i=0; i<node->count; i++) {
+        if (node->slots[i].key) {
+            ideobj_del(node->slots[i].key);
+            ideobj_del(node->slots[i].val);
+        } else {
+            idenode_del(node->slots[i].node);
+        }
+    }
+    free(node);
+}
+
+// Returns a node that is safe to modify in place. A shared node is
+// released and replaced with a copy sharing its entries and children.
+idenode* idenode_own(idenode* node) {
+    if (node->rc == 1) {
+        return node;
+    }
+
+    idenode* copy = idenode_new(node->count, node->collision);
+    copy->bitmap = node->bitmap;
+    memcpy(copy->slots, node->slots, sizeof(ideslot) * node->count);
+
+    for (int i=0; i<node->count; i++) {
+        if (copy->slots[i].key) {
+            copy->slots[i].key->rc++;
+            copy->slots[i].val->rc++;
+        } else {
+            copy->slots[i].node->rc++;
+        }
+    }
+
+    node->rc--;
+    return copy;
+}
+
+void idenode_collect(idenode* node, ideslot** entries, int* count) {
+    for (int i=0; i<node->count; i++) {
+        if (node->slots[i].key) {
+            entries[(*count)++] = &node->slots[i];
+        } else {
+            idenode_collect(node->slots[i].node, entries, count);
+        }
+    }
+}
+
+// Returns the size entries of hm in trie order, free the array after use
+ideslot** idemap_entries(ideobj* hm) {
+    ideslot** entries = malloc(sizeof(ideslot*) * (hm->size + 1));
+    int count = 0;
+    if (hm->root) {
+        idenode_collect(hm->root, entries, &count);
+    }
+    return entries;
+}
+
+int idemap_cmp_stamp(const void* a, const void* b) {
+    long left = (*(ideslot**) a)->stamp;
+    long right = (*(ideslot**) b)->stamp;
+    return (left > right) - (left < right);
+}
+
+// Returns the entries of hm in the order they were added
+ideslot** idemap_ordered(ideobj* hm) {
+    ideslot** entries = idemap_entries(hm);
+    qsort(entries, hm->size, sizeof(ideslot*), idemap_cmp_stamp);
+    return entries;
+}
+
 void ideenv_del(ideenv* env);
 
+// Explicit stacks for walking nested values on the heap instead of the C
+// stack, so nesting is only bounded by memory. A walk pushes above the
+// count it started from and drains back down to it, so walks can nest,
+// as when releasing a closure releases its env.
+typedef struct idestack {
+    ideobj** items;
+    int count;
+    int capacity;
+} idestack;
+
+void idestack_push(idestack* stack, ideobj* obj) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(
+            stack->items, sizeof(ideobj*) * stack->capacity
+        );
+    }
+    stack->items[stack->count++] = obj;
+}
+
+idestack idedel_stack;
+
+// The same for envs, see ideenv_del and idegc_mark_env
+typedef struct ideenv_stack {
+    ideenv** items;
+    int count;
+    int capacity;
+} ideenv_stack;
+
+void ideenv_stack_push(ideenv_stack* stack, ideenv* env) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(
+            stack->items, sizeof(ideenv*) * stack->capacity
+        );
+    }
+    stack->items[stack->count++] = env;
+}
+
 void ideobj_del(ideobj* obj) {
-    switch (obj->type) {
-        case IDEOBJ_ERR: free(obj->err); break;
-        case IDEOBJ_SYMBOL: free(obj->symbol); break;
-        case IDEOBJ_KEYWORD: free(obj->keyword); break;
-        case IDEOBJ_NUM: break;
-        case IDEOBJ_DECIMAL: break;
-        case IDEOBJ_BUILTIN: break;
-        case IDEOBJ_FUN:
-            ideenv_del(obj->env);
-            ideobj_del(obj->params);
-            ideobj_del(obj->body);
-            break;
-        case IDEOBJ_QEXPR:
-        case IDEOBJ_SEXPR:
-            for (int i=0; i<obj->count; i++) {
-                ideobj_del(obj->cell[i]);
-            }
-            free(obj->cell);
-            break;
-        case IDEOBJ_STR: free(obj->str); break;
-        case IDEOBJ_HASHMAP:
-            for (int i=0; i<obj->count; i++) {
-                ideobj_del(obj->keys[i]);
-                ideobj_del(obj->cell[i]);
-            }
-            free(obj->keys);
-            free(obj->cell);
-            break;
+    if (--obj->rc > 0) {
+        return;
     }
 
-    free(obj);
+    int base = idedel_stack.count;
+
+    while (1) {
+        switch (obj->type) {
+            case IDEOBJ_ERR: free(obj->err); break;
+            case IDEOBJ_SYMBOL: break;
+            case IDEOBJ_KEYWORD: break;
+            case IDEOBJ_NUM: break;
+            case IDEOBJ_DECIMAL: break;
+            case IDEOBJ_BUILTIN: break;
+            case IDEOBJ_FUN:
+                ideenv_del(obj->env);
+                idestack_push(&idedel_stack, obj->params);
+                idestack_push(&idedel_stack, obj->body);
+                break;
+            case IDEOBJ_QEXPR:
+            case IDEOBJ_SEXPR:
+                if (obj->base) {
+                    idestack_push(&idedel_stack, obj->base);
+                    break;
+                }
+
+                // Shared cells only lose a reference, the rest are
+                // released from the stack
+                for (int i=0; i<obj->count; i++) {
+                    ideobj* cell = obj->cell[i];
+                    if (cell->rc > 1) {
+                        cell->rc--;
+                    } else {
+                        idestack_push(&idedel_stack, cell);
+                    }
+                }
+                idelist_free(obj);
+                break;
+            case IDEOBJ_STR: free(obj->str); break;
+            case IDEOBJ_HASHMAP:
+                if (obj->root) {
+                    idenode_del(obj->root);
+                }
+                break;
+            case IDEOBJ_SEQ:
+                if (obj->seq->fn) {
+                    idestack_push(&idedel_stack, obj->seq->fn);
+                }
+                if (obj->seq->source) {
+                    idestack_push(&idedel_stack, obj->seq->source);
+                }
+                free(obj->seq);
+                break;
+        }
+
+        ideobj_free(obj);
+
+        do {
+            if (idedel_stack.count == base) {
+                return;
+            }
+            obj = idedel_stack.items[--idedel_stack.count];
+        } while (--obj->rc > 0);
+    }
 }
 
-ideenv* ideenv_copy(ideenv* env);
 void ideenv_print(ideenv* env);
 
+// Returns a new reference to obj, values are immutable once shared so
+// this is O(1) regardless of size.
 ideobj* ideobj_copy(ideobj* obj) {
-    ideobj* copy = malloc(sizeof(ideobj));
-    copy->type = obj->type;
+    obj->rc++;
+    return obj;
+}
+
+// Returns a reference to obj that is safe to modify in place. A shared obj
+// is released and replaced with a shallow copy sharing its children.
+ideobj* ideobj_cow(ideobj* obj) {
+    if (obj->rc == 1) {
+        if (obj->type == IDEOBJ_QEXPR || obj->type == IDEOBJ_SEXPR) {
+            if (obj->base) {
+                idelist_unview(obj);
+            }
+            idelist_changed(obj);
+        }
+        return obj;
+    }
+
+    ideobj* copy = ideobj_new(obj->type);
+    *copy = *obj;
+    copy->compiled = 0;
+    copy->rc = 1;
+    obj->rc--;
 
     switch (obj->type) {
-        case IDEOBJ_BUILTIN:
-            copy->builtin = obj->builtin;
-            break;
-        case IDEOBJ_NUM:
-            copy->num = obj->num;
-            break;
-        case IDEOBJ_DECIMAL:
-            copy->decimal= obj->decimal;
-            break;
         case IDEOBJ_ERR:
             copy->err = malloc(strlen(obj->err) + 1);
             strcpy(copy->err, obj->err);
             break;
-        case IDEOBJ_SYMBOL:
-            copy->symbol = malloc(strlen(obj->symbol) + 1);
-            strcpy(copy->symbol, obj->symbol);
+        case IDEOBJ_STR:
+            copy->str = malloc(strlen(obj->str) + 1);
+            strcpy(copy->str, obj->str);
             break;
         case IDEOBJ_QEXPR:
         case IDEOBJ_SEXPR:
+            copy->count = 0;
+            copy->offset = 0;
+            copy->cell = NULL;
+            copy->base = NULL;
+            idelist_reserve(copy, obj->count);
             copy->count = obj->count;
-            copy->cell = malloc(sizeof(ideobj) * copy->count);
             for (int i=0; i<obj->count; i++) {
                 copy->cell[i] = ideobj_copy(obj->cell[i]);
             }
             break;
         case IDEOBJ_FUN:
-            copy->env = ideenv_copy(obj->env);
-            copy->params = ideobj_copy(obj->params);
-            copy->body = ideobj_copy(obj->body);
-            break;
-        case IDEOBJ_STR:
-            copy->str = malloc(strlen(obj->str) + 1);
-            strcpy(copy->str, obj->str);
-            break;
-        case IDEOBJ_KEYWORD:
-            copy->keyword = malloc(strlen(obj->keyword) + 1);
-            strcpy(copy->keyword, obj->keyword);
+            copy->env->rc++;
+            ideobj_copy(copy->params);
+            ideobj_copy(copy->body);
             break;
         case IDEOBJ_HASHMAP:
-            copy->count = obj->count;
-            copy->keys = malloc(sizeof(ideobj) * copy->count);
-            copy->cell = malloc(sizeof(ideobj) * copy->count);
-            for (int i=0; i<obj->count; i++) {
-                copy->keys[i] = ideobj_copy(obj->keys[i]);
-                copy->cell[i] = ideobj_copy(obj->cell[i]);
+            if (copy->root) {
+                copy->root->rc++;
+            }
+            break;
+        case IDEOBJ_SEQ:
+            copy->seq = malloc(sizeof(ideseq));
+            *copy->seq = *obj->seq;
+            if (copy->seq->fn) {
+                ideobj_copy(copy->seq->fn);
+            }
+            if (copy->seq->source) {
+                ideobj_copy(copy->seq->source);
             }
             break;
     }
@@ -288,8 +1076,11 @@ ideobj* ideobj_copy(ideobj* obj) {
 }
 
 void ideobj_println(ideobj* obj);
+ideslot* idenode_find(idenode* node, ideobj* key, unsigned long hash);
 
-int ideobj_eq(ideobj* left, ideobj* right) {
+int ideobj_eq(ideobj* left, ideobj* right);
+
+int ideobj_eq_shallow(ideobj* left, ideobj* right) {
     if (left->type != right->type) {
         return 0;
     }
@@ -302,49 +1093,97 @@ int ideobj_eq(ideobj* left, ideobj* right) {
         case IDEOBJ_ERR:
             return strcmp(left->err, right->err) == 0;
         case IDEOBJ_SYMBOL:
-            return strcmp(left->symbol, right->symbol) == 0;
+            return left->symbol == right->symbol;
         case IDEOBJ_BUILTIN:
             return left->builtin == right->builtin;
         case IDEOBJ_FUN:
-            return ideobj_eq(left->params, right->params)
-                && ideobj_eq(left->body, right->body);
+            return 1;
         case IDEOBJ_QEXPR:
         case IDEOBJ_SEXPR:
-            if (left->count != right->count) {
+            return left->count == right->count;
+        case IDEOBJ_HASHMAP: {
+            if (left->size != right->size) {
                 return 0;
             }
 
-            for (int i=0; i<left->count; i++) {
-                if (ideobj_eq(left->cell[0], right->cell[0]) == 0) {
-                    return 0;
-                }
+            // Maps are equal when they hold the same entries, in any order
+            ideslot** entries = idemap_entries(left);
+            int eq = 1;
+            for (int i=0; i<left->size && eq; i++) {
+                ideslot* match = idenode_find(
+                    right->root, entries[i]->key, entries[i]->hash
+                );
+                eq = match && ideobj_eq(entries[i]->val, match->val);
             }
 
-            return 1;
-        case IDEOBJ_HASHMAP:
-            if (left->count != right->count) {
-                return 0;
-            }
-            for (int i=0; i<left->count; i++) {
-                if (ideobj_eq(left->keys[0], right->keys[0]) == 0) {
-                    return 0;
-                }
-                if (ideobj_eq(left->cell[0], right->cell[0]) == 0) {
-                    return 0;
-                }
-            }
-
-            return 1;
+            free(entries);
+            return eq;
+        }
 
         case IDEOBJ_STR:
             return strcmp(left->str, right->str) == 0;
         case IDEOBJ_KEYWORD:
-            return strcmp(left->keyword, right->keyword) == 0;
+            return left->keyword == right->keyword;
+        case IDEOBJ_SEQ:
+            // Realizing a sequence may call functions, so only the same
+            // sequence is equal to itself
+            return left == right;
     }
 
     return 0;
 }
 
+idestack ideeq_stack;
+
+// Compares the pairs of children from a stack, ideobj_eq_shallow compares
+// everything but the children of lists and functions
+int ideobj_eq(ideobj* left, ideobj* right) {
+    int base = ideeq_stack.count;
+    int eq = 1;
+
+    while (1) {
+        eq = ideobj_eq_shallow(left, right);
+        if (!eq) {
+            break;
+        }
+
+        if (left->type == IDEOBJ_FUN) {
+            idestack_push(&ideeq_stack, left->params);
+            idestack_push(&ideeq_stack, right->params);
+            idestack_push(&ideeq_stack, left->body);
+            idestack_push(&ideeq_stack, right->body);
+        } else if (left->type == IDEOBJ_QEXPR || left->type == IDEOBJ_SEXPR) {
+            // Cells without children are compared right away
+            for (int i=0; i<left->count && eq; i++) {
+                ideobj* a = left->cell[i];
+                ideobj* b = right->cell[i];
+                if (
+                    a->type == IDEOBJ_QEXPR ||
+                    a->type == IDEOBJ_SEXPR ||
+                    a->type == IDEOBJ_FUN
+                ) {
+                    idestack_push(&ideeq_stack, a);
+                    idestack_push(&ideeq_stack, b);
+                } else {
+                    eq = ideobj_eq_shallow(a, b);
+                }
+            }
+            if (!eq) {
+                break;
+            }
+        }
+
+        if (ideeq_stack.count == base) {
+            break;
+        }
+        right = ideeq_stack.items[--ideeq_stack.count];
+        left = ideeq_stack.items[--ideeq_stack.count];
+    }
+
+    ideeq_stack.count = base;
+    return eq;
+}
+
 int ideobj_truthy(ideobj* obj) {
     switch (obj->type) {
         case IDEOBJ_NUM:
@@ -362,27 +1201,12 @@ int ideobj_truthy(ideobj* obj) {
         case IDEOBJ_STR:
             return strlen(obj->str) > 0;
         case IDEOBJ_KEYWORD:
-            return strlen(obj->str) > 0;
+            return strlen(obj->keyword) > 0;
     }
 
     return 0;
 }
 
-void ideobj_print(ideobj* obj);
-
-void ideobj_expr_print(ideobj* obj, char* open, char* close) {
-    printf("%s", open);
-
-    for (int i=0; i<obj->count; i++) {
-        if (i > 0) {
-            putchar(' ');
-        }
-        ideobj_print(obj->cell[i]);
-    }
-
-    printf("%s", close);
-}
-
 void lval_print_str(ideobj* obj) {
     char* escaped = malloc(strlen(obj->str)+1);
     strcpy(escaped, obj->str);
@@ -393,7 +1217,24 @@ void lval_print_str(ideobj* obj) {
     free(escaped);
 }
 
-void ideobj_print(ideobj* obj) {
+// Lists being printed and the index of their next cell
+typedef struct ideprint_frame {
+    ideobj* list;
+    int next;
+} ideprint_frame;
+
+typedef struct ideprint_stack {
+    ideprint_frame* frames;
+    int count;
+    int capacity;
+} ideprint_stack;
+
+ideprint_stack ideprint_frames;
+
+void ideobj_print(ideobj* obj);
+
+// Prints everything but lists, which ideobj_print walks on a stack
+void ideobj_print_value(ideobj* obj) {
     switch (obj->type) {
         case IDEOBJ_ERR:
             printf("Error: %s", obj->err);
@@ -410,15 +1251,12 @@ void ideobj_print(ideobj* obj) {
         case IDEOBJ_KEYWORD:
             printf(":%s", obj->keyword);
             break;
-        case IDEOBJ_SEXPR:
-            ideobj_expr_print(obj, "(", ")");
-            break;
-        case IDEOBJ_QEXPR:
-            ideobj_expr_print(obj, "'(", ")");
-            break;
         case IDEOBJ_BUILTIN:
             printf("<builtin>");
             break;
+        case IDEOBJ_SEQ:
+            printf("<sequence>");
+            break;
         case IDEOBJ_FUN:
             printf("(fn ");
             ideobj_print(obj->params);
@@ -429,18 +1267,67 @@ void ideobj_print(ideobj* obj) {
         case IDEOBJ_STR:
             lval_print_str(obj);
             break;
-        case IDEOBJ_HASHMAP:
+        case IDEOBJ_HASHMAP: {
+            ideslot** entries = idemap_ordered(obj);
             putchar('{');
-            for (int i=0; i<obj->count; i++) {
+            for (int i=0; i<obj->size; i++) {
                 if (i > 0) {
                     putchar(' ');
                 }
-                ideobj_print(obj->keys[i]);
+                ideobj_print(entries[i]->key);
                 printf(": ");
-                ideobj_print(obj->cell[i]);
+                ideobj_print(entries[i]->val);
             }
             putchar('}');
+            free(entries);
             break;
+        }
+    }
+}
+
+void ideobj_print(ideobj* obj) {
+    int base = ideprint_frames.count;
+
+    while (1) {
+        if (obj->type == IDEOBJ_SEXPR || obj->type == IDEOBJ_QEXPR) {
+            printf(obj->type == IDEOBJ_SEXPR ? "(" : "'(");
+
+            if (ideprint_frames.count == ideprint_frames.capacity) {
+                ideprint_frames.capacity = ideprint_frames.capacity
+                    ? ideprint_frames.capacity * 2
+                    : 16;
+                ideprint_frames.frames = realloc(
+                    ideprint_frames.frames,
+                    sizeof(ideprint_frame) * ideprint_frames.capacity
+                );
+            }
+            ideprint_frames.frames[ideprint_frames.count++] =
+                (ideprint_frame) { obj, 0 };
+        } else {
+            ideobj_print_value(obj);
+        }
+
+        // Close every list that is done, then continue with the next cell
+        obj = NULL;
+        while (!obj && ideprint_frames.count > base) {
+            ideprint_frame* frame =
+                &ideprint_frames.frames[ideprint_frames.count - 1];
+
+            if (frame->next == frame->list->count) {
+                putchar(')');
+                ideprint_frames.count--;
+                continue;
+            }
+
+            if (frame->next > 0) {
+                putchar(' ');
+            }
+            obj = frame->list->cell[frame->next++];
+        }
+
+        if (!obj) {
+            return;
+        }
     }
 }
 
@@ -449,32 +1336,106 @@ void ideobj_println(ideobj* obj) {
     putchar('\n');
 }
 
+void idegc_link(ideenv* env) {
+    env->marked = 0;
+    env->gc_prev = NULL;
+    env->gc_next = gc.heap;
+    if (gc.heap) {
+        gc.heap->gc_prev = env;
+    }
+    gc.heap = env;
+    gc.count++;
+}
+
+void idegc_unlink(ideenv* env) {
+    if (env->gc_prev) {
+        env->gc_prev->gc_next = env->gc_next;
+    } else {
+        gc.heap = env->gc_next;
+    }
+    if (env->gc_next) {
+        env->gc_next->gc_prev = env->gc_prev;
+    }
+    gc.count--;
+}
+
+// Small frames are searched linearly. Once a frame holds more than
+// IDEENV_HASH_THRESHOLD bindings it also gets an open-addressed index
+// from symbol to slot, kept at most half full. The symbols and values
+// arrays stay in definition order either way.
+#define IDEENV_HASH_THRESHOLD 8
+
 ideenv* ideenv_new(void) {
-    ideenv* env = malloc(sizeof(ideenv));
+    ideenv* env = ideslab_alloc(&ideenv_slab);
+    idegc_link(env);
+    env->rc = 1;
     env->parent = NULL;
+    env->caller = NULL;
     env->count = 0;
+    env->capacity = 0;
     env->symbols = NULL;
     env->values = NULL;
     env->depth = -1;
+    env->index = NULL;
+    env->index_capacity = 0;
+    return env;
+}
+
+// Environments are reference counted, an env holds a reference to its
+// parent and a function to the env it was defined in.
+ideenv* ideenv_retain(ideenv* env) {
+    env->rc++;
     return env;
 }
 
 ideenv* ideenv_new_enclosed(ideenv* env) {
     ideenv* enclosed_env = ideenv_new();
-    enclosed_env->parent = env;
+    enclosed_env->parent = ideenv_retain(env);
     enclosed_env->depth = env->depth+1;
     return enclosed_env;
 }
 
+// Envs released while another is being released, through its parent,
+// caller or a closure bound in it, are queued and released by the
+// outermost call instead of recursing, so chains of any length are
+// released in constant C stack.
+ideenv_stack idedel_envs;
+int idedel_envs_active = 0;
+
 void ideenv_del(ideenv* env) {
-    for (int i=0; i<env->count; i++) {
-        free(env->symbols[i]);
-        ideobj_del(env->values[i]);
+    if (--env->rc > 0) {
+        return;
+    }
+
+    ideenv_stack_push(&idedel_envs, env);
+    if (idedel_envs_active) {
+        return;
+    }
+    idedel_envs_active = 1;
+
+    while (idedel_envs.count > 0) {
+        env = idedel_envs.items[--idedel_envs.count];
+
+        for (int i=0; i<env->count; i++) {
+            IDEATOM_OF(env->symbols[i])->binds--;
+            ideobj_del(env->values[i]);
+        }
+
+        if (env->parent) {
+            ideenv_del(env->parent);
+        }
+        if (env->caller) {
+            ideenv_del(env->caller);
+        }
+
+        idegc_unlink(env);
+        free(env->symbols);
+        free(env->values);
+        free(env->index);
+        ideslab_free(&ideenv_slab, env);
     }
 
-    free(env->symbols);
-    free(env->values);
-    free(env);
+    idedel_envs_active = 0;
 }
 
 void ideenv_print(ideenv* env) {
@@ -503,199 +1464,971 @@ void ideenv_println(ideenv* env) {
     putchar('\n');
 }
 
-ideenv* ideenv_copy(ideenv* env) {
-    ideenv* copy = malloc(sizeof(ideenv));
-    copy->parent = env->parent;
-    copy->count = env->count;
-    copy->depth = env->depth;
-    copy->symbols = malloc(sizeof(char*) * copy->count);
-    copy->values = malloc(sizeof(ideobj*) * copy->count);
+// Interned names are compared by address, so the address is the hash
+unsigned long idehash_ptr(void* ptr) {
+    unsigned long hash = (uintptr_t) ptr;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    return hash;
+}
 
-    for (int i=0; i<copy->count; i++) {
-        copy->symbols[i] = malloc(strlen(env->symbols[i]) + 1);
-        strcpy(copy->symbols[i], env->symbols[i]);
-        copy->values[i] = ideobj_copy(env->values[i]);
+void ideenv_index_insert(ideenv* env, int slot) {
+    int mask = env->index_capacity - 1;
+    int i = idehash_ptr(env->symbols[slot]) & mask;
+    while (env->index[i]) {
+        i = (i + 1) & mask;
     }
-
-    return copy;
+    // Zero marks an empty entry, so slots are stored off by one
+    env->index[i] = slot + 1;
 }
 
-ideobj* ideenv_get(ideenv* env, ideobj* key) {
+void ideenv_reindex(ideenv* env) {
+    int capacity = 2 * IDEENV_HASH_THRESHOLD;
+    while (capacity < env->count * 2) {
+        capacity *= 2;
+    }
+
+    free(env->index);
+    env->index = calloc(capacity, sizeof(int));
+    env->index_capacity = capacity;
+
     for (int i=0; i<env->count; i++) {
-        if (strcmp(env->symbols[i], key->symbol) == 0) {
-            return ideobj_copy(env->values[i]);
+        ideenv_index_insert(env, i);
+    }
+}
+
+// Returns the slot symbol is bound to in this frame, or -1
+int ideenv_find(ideenv* env, char* symbol) {
+    if (!env->index) {
+        for (int i=0; i<env->count; i++) {
+            if (env->symbols[i] == symbol) {
+                return i;
+            }
         }
+        return -1;
     }
 
-    if (env->parent) {
-        return ideenv_get(env->parent, key);
-    } else {
-        return ideobj_err("Unbound symbol '%s'", key->symbol);
+    int mask = env->index_capacity - 1;
+    int i = idehash_ptr(symbol) & mask;
+    while (env->index[i]) {
+        int slot = env->index[i] - 1;
+        if (env->symbols[slot] == symbol) {
+            return slot;
+        }
+        i = (i + 1) & mask;
     }
+    return -1;
 }
 
-void ideenv_put(ideenv* env, ideobj* key, ideobj* val) {
-    for (int i=0; i<env->count; i++) {
-        if (
-            key->type == IDEOBJ_SYMBOL &&
-            strcmp(env->symbols[i], key->symbol) == 0
-        ) {
-            ideobj_del(env->values[i]);
-            env->values[i] = ideobj_copy(val);
-            return;
+// Returns the value bound to name, without taking a reference, or NULL.
+// Call frames only hold their parameters, so a frame is searched
+// together with the chain of envs it was called from before moving on
+// to its parent. This is the same order as when a call frame started
+// out as a copy of its caller.
+ideobj* ideenv_binding(ideenv* env, char* name) {
+    for (ideenv* scope = env; scope; scope = scope->parent) {
+        for (ideenv* frame = scope; frame; frame = frame->caller) {
+            int slot = ideenv_find(frame, name);
+            if (slot >= 0) {
+                return frame->values[slot];
+            }
         }
+    }
 
-        if (
-            key->type == IDEOBJ_KEYWORD &&
-            strcmp(env->symbols[i], key->keyword) == 0
-        ) {
-            ideobj_del(env->values[i]);
-            env->values[i] = ideobj_copy(val);
-            return;
+    return NULL;
+}
+
+void ideenv_put_name(ideenv* env, char* key_str, ideobj* val);
+
+// Unlinks the caller of a call frame, so tail calls run in constant
+// memory whatever names the functions involved bind. The caller's
+// bindings that env doesn't shadow are copied into env first, where
+// lookups find them before anything past the caller, as they did in the
+// caller. This is only safe once the caller is done running and can
+// bind no more names, as when env replaces it in a tail call, see
+// idevm_run.
+void ideenv_skip_caller(ideenv* env) {
+    ideenv* caller = env->caller;
+    if (!caller) {
+        return;
+    }
+
+    for (int i=0; i<caller->count; i++) {
+        if (ideenv_find(env, caller->symbols[i]) < 0) {
+            ideenv_put_name(env, caller->symbols[i], caller->values[i]);
         }
     }
 
-    char *key_str;
+    env->caller = caller->caller ? ideenv_retain(caller->caller) : NULL;
+    ideenv_del(caller);
+}
+
+ideobj* ideenv_get(ideenv* env, ideobj* key) {
+    ideobj* value = ideenv_binding(env, key->symbol);
+    if (!value) {
+        return ideobj_err("Unbound symbol '%s'", key->symbol);
+    }
+    return ideobj_copy(value);
+}
+
+void ideenv_put_name(ideenv* env, char* key_str, ideobj* val);
+
+void ideenv_put(ideenv* env, ideobj* key, ideobj* val) {
+    // Symbols and keywords share the interned names
+    ideenv_put_name(
+        env, key->type == IDEOBJ_KEYWORD ? key->keyword : key->symbol, val
+    );
+}
 
-    if (key->type == IDEOBJ_KEYWORD) {
-        key_str = malloc(strlen(key->keyword) + 1);
-        strcpy(key_str, key->keyword);
+void ideenv_put_name(ideenv* env, char* key_str, ideobj* val) {
+    int slot = ideenv_find(env, key_str);
+    if (slot >= 0) {
+        ideobj_del(env->values[slot]);
+        env->values[slot] = ideobj_copy(val);
+        return;
     }
-    if (key->type == IDEOBJ_SYMBOL) {
-        key_str = malloc(strlen(key->symbol) + 1);
-        strcpy(key_str, key->symbol);
+
+    if (env->count == env->capacity) {
+        env->capacity = env->capacity ? env->capacity * 2 : 4;
+        env->values = realloc(env->values, sizeof(ideobj*) * env->capacity);
+        env->symbols = realloc(env->symbols, sizeof(char*) * env->capacity);
     }
 
+    env->values[env->count] = ideobj_copy(val);
+    env->symbols[env->count] = key_str;
     env->count++;
-    env->values = realloc(env->values, sizeof(ideobj*) * env->count);
-    env->symbols = realloc(env->symbols, sizeof(char*) * env->count);
+    IDEATOM_OF(key_str)->binds++;
 
-    env->values[env->count - 1] = ideobj_copy(val);
-    env->symbols[env->count - 1] = malloc(strlen(key_str) + 1);
-    strcpy(env->symbols[env->count - 1], key_str);
+    if (env->count > IDEENV_HASH_THRESHOLD) {
+        if (env->count * 2 > env->index_capacity) {
+            ideenv_reindex(env);
+        } else {
+            ideenv_index_insert(env, env->count - 1);
+        }
+    }
 }
 
-void ideenv_global_put(ideenv* env, ideobj* key, ideobj* val) {
-    while(env->parent) {
+ideenv* ideenv_global(ideenv* env) {
+    while (env->parent) {
         env = env->parent;
     }
+    return env;
+}
 
-    ideenv_put(env, key, val);
+void ideenv_global_put(ideenv* env, ideobj* key, ideobj* val) {
+    ideenv_put(ideenv_global(env), key, val);
 }
 
-ideobj* eval_tenary_number_op(ideobj* left, char* operator, ideobj* right) {
-    if (strcmp(operator, "+") == 0) {
-        return ideobj_num(left->num + right->num);
+// Symbols are resolved to lexical addresses when the fn, defn or let
+// around them is created. A local is addressed by the number of parent
+// hops to its frame and its slot there. A global is addressed by its
+// slot in the global env, which never changes because bindings are
+// only ever appended or overwritten in place. Addresses are hints, they
+// are checked before use and lookup falls back to the name when one is
+// stale. Because of this, rebinding with def or defl never needs to
+// patch the symbols it affects.
+ideobj* ideenv_lookup(ideenv* env, ideobj* sym) {
+    char* name = sym->symbol;
+
+    if (sym->depth >= 0) {
+        ideenv* frame = env;
+        for (int i=0; i<sym->depth && frame; i++) {
+            // A nearer frame, or the envs it was called from, could
+            // shadow the address
+            if (frame->caller || ideenv_find(frame, name) >= 0) {
+                frame = NULL;
+                break;
+            }
+            frame = frame->parent;
+        }
+
+        if (
+            frame &&
+            sym->slot < frame->count &&
+            frame->symbols[sym->slot] == name
+        ) {
+            return ideobj_copy(frame->values[sym->slot]);
+        }
     }
-    if (strcmp(operator, "-") == 0) {
-        return ideobj_num(left->num - right->num);
+
+    // A name bound only once is bound only in the global env, so no frame
+    // in between can shadow it
+    int global_only = IDEATOM_OF(name)->binds == 1;
+
+    if (sym->depth == IDEADDR_GLOBAL && global_only) {
+        ideenv* global = ideenv_global(env);
+        if (sym->slot < global->count && global->symbols[sym->slot] == name) {
+            return ideobj_copy(global->values[sym->slot]);
+        }
     }
-    if (strcmp(operator, "*") == 0) {
-        return ideobj_num(left->num * right->num);
+
+    // A stale address is replaced when the name turns out to be bound in
+    // the current frame, which recursive calls tend to lay out the same
+    int slot = ideenv_find(env, name);
+    if (slot >= 0) {
+        sym->depth = env->parent ? 0 : IDEADDR_GLOBAL;
+        sym->slot = slot;
+        return ideobj_copy(env->values[slot]);
     }
-    if (strcmp(operator, "/") == 0) {
-        if (right->num == 0) {
-            return ideobj_err("Division by zero");
+
+    ideobj* value = ideenv_get(env, sym);
+
+    // Globals defined after the code referencing them, such as a
+    // recursive defn, get their address on first use
+    if (sym->depth == IDEADDR_NONE && global_only && value->type != IDEOBJ_ERR) {
+        slot = ideenv_find(ideenv_global(env), name);
+        if (slot >= 0) {
+            sym->depth = IDEADDR_GLOBAL;
+            sym->slot = slot;
         }
-        return ideobj_num(left->num / right->num);
     }
-    if (strcmp(operator, "%") == 0) {
-        if (right->num == 0) {
-            return ideobj_err("Modulo by zero");
-        }
-        return ideobj_num(left->num % right->num);
+
+    return value;
+}
+
+// Names bound by one enclosing fn or let. `hops` is the number of
+// parent links from its frame to the frame of `outer`.
+typedef struct idescope {
+    ideobj* names;
+    int hops;
+    struct idescope* outer;
+} idescope;
+
+int idescope_slot(idescope* scope, char* name) {
+    // Interned names never move, so they are looked up once
+    static char* rest = NULL;
+    if (!rest) {
+        rest = ideintern("&rest");
     }
-    if (strcmp(operator, "^") == 0) {
-        return ideobj_num(pow(left->num, right->num));
+    int slot = 0;
+
+    // Slots follow the order in which parameters are bound
+    for (int i=0; i<scope->names->count; i++) {
+        ideobj* param = scope->names->cell[i];
+        if (param->type != IDEOBJ_SYMBOL || param->symbol == rest) {
+            continue;
+        }
+        if (param->symbol == name) {
+            return slot;
+        }
+        slot++;
     }
-    if (strcmp(operator, "min") == 0) {
-        return ideobj_num(
-            left->num < right->num ? left->num : right->num
+
+    return -1;
+}
+
+// Name is interned
+int ideobj_is_form(ideobj* expr, char* name, int count) {
+    return expr->count == count
+        && expr->cell[0]->type == IDEOBJ_SYMBOL
+        && expr->cell[0]->symbol == name;
+}
+
+// Pending resolves, each an expression with the scope it is in
+typedef struct ideresolve_stack {
+    ideobj** exprs;
+    idescope** scopes;
+    int count;
+    int capacity;
+} ideresolve_stack;
+
+void ideresolve_push(ideresolve_stack* stack, ideobj* expr, idescope* scope) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->exprs = realloc(stack->exprs, sizeof(ideobj*) * stack->capacity);
+        stack->scopes = realloc(
+            stack->scopes, sizeof(idescope*) * stack->capacity
         );
     }
-    if (strcmp(operator, "max") == 0) {
-        return ideobj_num(left->num > right->num ? left->num : right->num);
+    stack->exprs[stack->count] = expr;
+    stack->scopes[stack->count] = scope;
+    stack->count++;
+}
+
+ideresolve_stack ideresolve_pending;
+
+// Gives symbols the address of their binding, walking expressions from a
+// stack so that nesting is only bounded by memory. Scopes of the fn, defn
+// and let forms met on the way live until the walk is done.
+void ideobj_resolve(ideobj* expr, idescope* scope, ideenv* global) {
+    static char* fn = NULL;
+    static char* defn;
+    static char* let;
+    if (!fn) {
+        fn = ideintern("fn");
+        defn = ideintern("defn");
+        let = ideintern("let");
+    }
+
+    int base = ideresolve_pending.count;
+    idescope** inners = NULL;
+    int inner_count = 0;
+    int inner_capacity = 0;
+
+    while (1) {
+        switch (expr->type) {
+            case IDEOBJ_SYMBOL: {
+                int depth = 0;
+                int found = 0;
+                for (idescope* s = scope; s; s = s->outer) {
+                    int slot = idescope_slot(s, expr->symbol);
+                    if (slot >= 0) {
+                        expr->depth = depth;
+                        expr->slot = slot;
+                        found = 1;
+                        break;
+                    }
+                    depth += s->hops;
+                }
+
+                // Keep addresses an enclosing resolve gave the symbol
+                if (!found && expr->depth < 0) {
+                    int slot = ideenv_find(global, expr->symbol);
+                    expr->depth = slot >= 0 ? IDEADDR_GLOBAL : IDEADDR_NONE;
+                    expr->slot = slot;
+                }
+                break;
+            }
+            case IDEOBJ_QEXPR:
+            case IDEOBJ_SEXPR: {
+                // A fn body runs in a call frame whose parent is the fn's
+                // own env, whose parent is the frame the fn was created in
+                idescope inner = { NULL, 0, scope };
+                int body = -1;
+
+                if (ideobj_is_form(expr, fn, 3)) {
+                    inner.names = expr->cell[1];
+                    inner.hops = 2;
+                    body = 2;
+                }
+                if (ideobj_is_form(expr, defn, 4)) {
+                    inner.names = expr->cell[2];
+                    inner.hops = 2;
+                    body = 3;
+                }
+                if (ideobj_is_form(expr, let, 4)) {
+                    inner.names = expr->cell[1];
+                    inner.hops = 1;
+                    body = 3;
+                }
+                if (inner.names && inner.names->type != IDEOBJ_QEXPR) {
+                    body = -1;
+                }
+
+                idescope* body_scope = scope;
+                if (body >= 0) {
+                    body_scope = malloc(sizeof(idescope));
+                    *body_scope = inner;
+                    if (inner_count == inner_capacity) {
+                        inner_capacity = inner_capacity ? inner_capacity * 2 : 8;
+                        inners = realloc(
+                            inners, sizeof(idescope*) * inner_capacity
+                        );
+                    }
+                    inners[inner_count++] = body_scope;
+                }
+
+                for (int i=expr->count-1; i>=0; i--) {
+                    ideresolve_push(
+                        &ideresolve_pending,
+                        expr->cell[i],
+                        i == body ? body_scope : scope
+                    );
+                }
+                break;
+            }
+            case IDEOBJ_HASHMAP: {
+                ideslot** entries = idemap_entries(expr);
+                for (int i=expr->size-1; i>=0; i--) {
+                    ideresolve_push(&ideresolve_pending, entries[i]->val, scope);
+                }
+                free(entries);
+                break;
+            }
+        }
+
+        if (ideresolve_pending.count == base) {
+            break;
+        }
+        ideresolve_pending.count--;
+        expr = ideresolve_pending.exprs[ideresolve_pending.count];
+        scope = ideresolve_pending.scopes[ideresolve_pending.count];
+    }
+
+    for (int i=0; i<inner_count; i++) {
+        free(inners[i]);
     }
+    free(inners);
+}
+
+idestack idegc_mark_stack;
+ideenv_stack idegc_env_stack;
+
+// Sets the mark on everything reachable from the values and envs pushed
+// on the mark stacks above base and env_base, or clears it from the
+// values again. Envs are only pushed while marking, their parents are
+// followed in place and their callers pushed, so neither long chains of
+// envs nor closures nested in closures use the C stack.
+void idegc_mark_drain(int base, int env_base, int marked) {
+    while (1) {
+        if (idegc_mark_stack.count > base) {
+            ideobj* obj = idegc_mark_stack.items[--idegc_mark_stack.count];
+            if (obj->marked == marked) {
+                continue;
+            }
+            obj->marked = marked;
+
+            switch (obj->type) {
+                case IDEOBJ_FUN:
+                    idestack_push(&idegc_mark_stack, obj->params);
+                    idestack_push(&idegc_mark_stack, obj->body);
+                    if (marked) {
+                        ideenv_stack_push(&idegc_env_stack, obj->env);
+                    }
+                    break;
+                case IDEOBJ_QEXPR:
+                case IDEOBJ_SEXPR:
+                    // The base holds more than the view shows
+                    if (obj->base) {
+                        idestack_push(&idegc_mark_stack, obj->base);
+                        break;
+                    }
+
+                    for (int i=0; i<obj->count; i++) {
+                        if (obj->cell[i]->marked != marked) {
+                            idestack_push(&idegc_mark_stack, obj->cell[i]);
+                        }
+                    }
+                    break;
+                case IDEOBJ_HASHMAP: {
+                    ideslot** entries = idemap_entries(obj);
+                    for (int i=0; i<obj->size; i++) {
+                        idestack_push(&idegc_mark_stack, entries[i]->key);
+                        idestack_push(&idegc_mark_stack, entries[i]->val);
+                    }
+                    free(entries);
+                    break;
+                }
+                case IDEOBJ_SEQ:
+                    if (obj->seq->fn) {
+                        idestack_push(&idegc_mark_stack, obj->seq->fn);
+                    }
+                    if (obj->seq->source) {
+                        idestack_push(&idegc_mark_stack, obj->seq->source);
+                    }
+                    break;
+            }
+            continue;
+        }
+
+        if (idegc_env_stack.count > env_base) {
+            ideenv* env = idegc_env_stack.items[--idegc_env_stack.count];
+            for (; env && !env->marked; env = env->parent) {
+                env->marked = 1;
+                for (int i=0; i<env->count; i++) {
+                    if (env->values[i]->marked != 1) {
+                        idestack_push(&idegc_mark_stack, env->values[i]);
+                    }
+                }
+                if (env->caller) {
+                    ideenv_stack_push(&idegc_env_stack, env->caller);
+                }
+            }
+            continue;
+        }
 
-    return ideobj_err("Invalid operator '%s'", operator);
+        return;
+    }
 }
 
-int ideobj_is_numeric(ideobj *obj) {
-    return obj->type == IDEOBJ_NUM || obj->type == IDEOBJ_DECIMAL;
+void idegc_mark_env(ideenv* env) {
+    int base = idegc_mark_stack.count;
+    int env_base = idegc_env_stack.count;
+    ideenv_stack_push(&idegc_env_stack, env);
+    idegc_mark_drain(base, env_base, 1);
 }
 
-ideobj* eval_tenary_decimal_op(ideobj* left, char* operator, ideobj* right) {
-    double left_value = left->decimal;
-    double right_value = right->decimal;
+// Sets the mark on everything reachable from obj, or clears it again
+void idegc_mark_obj(ideobj* obj, int marked) {
+    int base = idegc_mark_stack.count;
+    int env_base = idegc_env_stack.count;
+    idestack_push(&idegc_mark_stack, obj);
+    idegc_mark_drain(base, env_base, marked);
+}
 
-    if (left->type == IDEOBJ_NUM) {
-        left_value = (double) left->num;
+void idegc_push(ideenv* env) {
+    if (gc.stack_count == gc.stack_capacity) {
+        gc.stack_capacity = gc.stack_capacity ? gc.stack_capacity * 2 : 16;
+        gc.stack = realloc(gc.stack, sizeof(ideenv*) * gc.stack_capacity);
     }
+    gc.stack[gc.stack_count++] = env;
+}
+
+void idegc_pop(void) {
+    gc.stack_count--;
+}
+
+idestack idegc_roots;
+idestack idegc_trial_seen;
+idestack idegc_trial_objs;
+ideenv_stack idegc_trial_envs;
 
-    if (right->type == IDEOBJ_NUM) {
-        right_value = (double) right->num;
+void idevm_roots(idestack* roots, ideenv_stack* envs);   // Forward declaration
+
+// Takes back the reference one unmarked value or env holds on another
+void idegc_trial_obj(ideobj* obj) {
+    if (obj->marked == 1) {
+        return;
+    }
+    obj->rc--;
+    idestack_push(&idegc_trial_objs, obj);
+    if (obj->marked != 2) {
+        obj->marked = 2;
+        idestack_push(&idegc_trial_seen, obj);
     }
+}
 
-    if (strcmp(operator, "+") == 0) {
-        return ideobj_decimal(left_value + right_value);
+void idegc_trial_env(ideenv* env) {
+    if (env->marked) {
+        return;
     }
-    if (strcmp(operator, "-") == 0) {
-        return ideobj_decimal(left_value - right_value);
+    env->rc--;
+    ideenv_stack_push(&idegc_trial_envs, env);
+}
+
+// Marks the unmarked envs that are still held from outside the heap, by
+// builtins and evaluations in progress on the C stack. Taking back the
+// references that unmarked envs, and the values reachable from them, hold
+// on each other leaves a count above zero only on what is held from
+// elsewhere, and everything reachable from there is marked too. Maps and
+// sequences are not looked into, so what they hold always counts as held
+// from elsewhere.
+void idegc_mark_held(void) {
+    for (ideenv* env = gc.heap; env; env = env->gc_next) {
+        if (env->marked) {
+            continue;
+        }
+        for (int i=0; i<env->count; i++) {
+            idegc_trial_obj(env->values[i]);
+        }
+        if (env->parent) {
+            idegc_trial_env(env->parent);
+        }
+        if (env->caller) {
+            idegc_trial_env(env->caller);
+        }
     }
-    if (strcmp(operator, "*") == 0) {
-        return ideobj_decimal(left_value * right_value);
+
+    // Values seen are appended while the list is walked
+    for (int i=0; i<idegc_trial_seen.count; i++) {
+        ideobj* obj = idegc_trial_seen.items[i];
+        switch (obj->type) {
+            case IDEOBJ_FUN:
+                idegc_trial_obj(obj->params);
+                idegc_trial_obj(obj->body);
+                idegc_trial_env(obj->env);
+                break;
+            case IDEOBJ_QEXPR:
+            case IDEOBJ_SEXPR:
+                if (obj->base) {
+                    idegc_trial_obj(obj->base);
+                    break;
+                }
+                for (int j=0; j<obj->count; j++) {
+                    idegc_trial_obj(obj->cell[j]);
+                }
+                break;
+        }
     }
-    if (strcmp(operator, "/") == 0) {
-        if (right->num == 0) {
-            return ideobj_err("Division by zero");
+
+    int base = idegc_mark_stack.count;
+    int env_base = idegc_env_stack.count;
+    for (int i=0; i<idegc_trial_seen.count; i++) {
+        ideobj* obj = idegc_trial_seen.items[i];
+        if (obj->rc > 0) {
+            idestack_push(&idegc_roots, obj);
+            idestack_push(&idegc_mark_stack, obj);
         }
-        return ideobj_decimal(left_value / right_value);
     }
-    if (strcmp(operator, "^") == 0) {
-        return ideobj_decimal(pow(left_value, right_value));
+    for (ideenv* env = gc.heap; env; env = env->gc_next) {
+        if (!env->marked && env->rc > 0) {
+            ideenv_stack_push(&idegc_env_stack, env);
+        }
     }
-    if (strcmp(operator, "min") == 0) {
-        return ideobj_decimal(
-            left_value < right_value ? left_value : right_value
-        );
+
+    for (int i=0; i<idegc_trial_objs.count; i++) {
+        idegc_trial_objs.items[i]->rc++;
     }
-    if (strcmp(operator, "max") == 0) {
-        return ideobj_decimal(left_value > right_value ? left_value : right_value);
+    for (int i=0; i<idegc_trial_envs.count; i++) {
+        idegc_trial_envs.items[i]->rc++;
     }
+    idegc_trial_objs.count = 0;
+    idegc_trial_envs.count = 0;
 
-    return ideobj_err("Invalid operator '%s'", operator);
-}
+    idegc_mark_drain(base, env_base, 1);
 
-ideobj* ideobj_list_add(ideobj* left, ideobj* right) {
-    left->count++;
-    left->cell = realloc(left->cell, sizeof(ideobj*) * left->count);
-    left->cell[left->count-1] = right;
-    return left;
+    // What was not reached from there is left unmarked for the sweep
+    for (int i=0; i<idegc_trial_seen.count; i++) {
+        if (idegc_trial_seen.items[i]->marked == 2) {
+            idegc_trial_seen.items[i]->marked = 0;
+        }
+    }
+    idegc_trial_seen.count = 0;
 }
 
-ideobj* ideobj_pop(ideobj* obj, int i) {
-    ideobj* el = obj->cell[i];
-
-    memmove(
-        &obj->cell[i], &obj->cell[i+1], sizeof(ideobj*) * (obj->count-i-1)
-    );
-
-    obj->count--;
-    obj->cell = realloc(obj->cell, sizeof(ideobj*) * obj->count);
-    return el;
-}
+void idegc_collect(void) {
+    clock_t start = clock();
 
-ideobj* ideobj_take(ideobj* obj, int i) {
-    ideobj* el = ideobj_pop(obj, i);
-    ideobj_del(obj);
-    return el;
-}
+    for (int i=0; i<gc.stack_count; i++) {
+        idegc_mark_env(gc.stack[i]);
+    }
 
-#define IASSERT(args, cond, format, ...) \
-    if (!(cond)) { \
-        ideobj* error = ideobj_err(format, ##__VA_ARGS__); \
-        ideobj_del(args); \
-        return error; \
+    int base = idegc_mark_stack.count;
+    int env_base = idegc_env_stack.count;
+    idevm_roots(&idegc_roots, &idegc_env_stack);
+    for (int i=0; i<idegc_roots.count; i++) {
+        idestack_push(&idegc_mark_stack, idegc_roots.items[i]);
+    }
+    idegc_mark_drain(base, env_base, 1);
+    idegc_mark_held();
+
+    // Unreachable envs are moved to their own list and pinned, so that
+    // releasing their bindings can not free them while we are iterating
+    ideenv* garbage = NULL;
+    ideenv* env = gc.heap;
+    while (env) {
+        ideenv* next = env->gc_next;
+        if (!env->marked) {
+            idegc_unlink(env);
+            env->gc_next = garbage;
+            garbage = env;
+            env->rc++;
+        }
+        env = next;
+    }
+
+    for (env = garbage; env; env = env->gc_next) {
+        for (int i=0; i<env->count; i++) {
+            IDEATOM_OF(env->symbols[i])->binds--;
+            ideobj_del(env->values[i]);
+        }
+        env->count = 0;
+        free(env->index);
+        env->index = NULL;
+        env->index_capacity = 0;
+
+        if (env->parent) {
+            ideenv_del(env->parent);
+            env->parent = NULL;
+        }
+        if (env->caller) {
+            ideenv_del(env->caller);
+            env->caller = NULL;
+        }
+    }
+
+    while (garbage) {
+        env = garbage;
+        garbage = env->gc_next;
+
+        if (--env->rc > 0) {
+            idegc_link(env);
+            continue;
+        }
+
+        free(env->symbols);
+        free(env->values);
+        ideslab_free(&ideenv_slab, env);
+        gc.freed++;
+    }
+
+    long live = 0;
+    for (env = gc.heap; env; env = env->gc_next) {
+        env->marked = 0;
+        for (int i=0; i<env->count; i++) {
+            idegc_mark_obj(env->values[i], 0);
+        }
+        live++;
+    }
+    for (int i=0; i<idegc_roots.count; i++) {
+        idegc_mark_obj(idegc_roots.items[i], 0);
+    }
+    idegc_roots.count = 0;
+
+    gc.collections++;
+    gc.threshold = live * 2 > IDEGC_MIN_THRESHOLD ? live * 2 : IDEGC_MIN_THRESHOLD;
+
+    double pause = (double) (clock() - start) * 1000 / CLOCKS_PER_SEC;
+    gc.pause_total += pause;
+    if (pause > gc.pause_max) {
+        gc.pause_max = pause;
+    }
+}
+
+// Called between top-level expressions and when a call starts, where
+// nothing is halfway through changing an env or the machine
+void idegc_safepoint(void) {
+    if (gc.count >= gc.threshold) {
+        idegc_collect();
+    }
+}
+
+// Arithmetic and comparison operators. The builtins applying them pass
+// theirs to builtin_op, builtin_ord or builtin_cmp, and are tagged with
+// it so the VM can apply them to numbers directly, see idearith_call.
+enum {
+    IDEARITH_NONE = -1,
+    IDEARITH_ADD,
+    IDEARITH_SUB,
+    IDEARITH_MUL,
+    IDEARITH_DIV,
+    IDEARITH_MOD,
+    IDEARITH_POW,
+    IDEARITH_MIN,
+    IDEARITH_MAX,
+    IDEARITH_GT,
+    IDEARITH_GTE,
+    IDEARITH_LT,
+    IDEARITH_LTE,
+    IDEARITH_EQ,
+    IDEARITH_NEQ,
+};
+
+char* idearith_names[] = {
+    "+", "-", "*", "/", "%", "^", "min", "max",
+    ">", ">=", "<", "<=", "==", "!="
+};
+
+int ideobj_is_numeric(ideobj *obj) {
+    return obj->type == IDEOBJ_NUM || obj->type == IDEOBJ_DECIMAL;
+}
+
+double ideobj_decimal_value(ideobj* obj) {
+    return obj->type == IDEOBJ_NUM ? (double) obj->num : obj->decimal;
+}
+
+// Folds count numbers with op into *out. Every operator has a loop of its
+// own and accumulates in a local, nothing is allocated per step. Returns
+// an error message, or NULL on success.
+char* idearith_num(int op, ideobj** cells, int count, long* out) {
+    long acc = cells[0]->num;
+
+    switch (op) {
+        case IDEARITH_ADD:
+            for (int i=1; i<count; i++) {
+                acc += cells[i]->num;
+            }
+            break;
+        case IDEARITH_SUB:
+            if (count == 1) {
+                acc = -acc;
+            }
+            for (int i=1; i<count; i++) {
+                acc -= cells[i]->num;
+            }
+            break;
+        case IDEARITH_MUL:
+            for (int i=1; i<count; i++) {
+                acc *= cells[i]->num;
+            }
+            break;
+        case IDEARITH_DIV:
+            for (int i=1; i<count; i++) {
+                if (cells[i]->num == 0) {
+                    return "Division by zero";
+                }
+                acc /= cells[i]->num;
+            }
+            break;
+        case IDEARITH_MOD:
+            for (int i=1; i<count; i++) {
+                if (cells[i]->num == 0) {
+                    return "Modulo by zero";
+                }
+                acc %= cells[i]->num;
+            }
+            break;
+        case IDEARITH_POW:
+            for (int i=1; i<count; i++) {
+                acc = pow(acc, cells[i]->num);
+            }
+            break;
+        case IDEARITH_MIN:
+            for (int i=1; i<count; i++) {
+                acc = cells[i]->num < acc ? cells[i]->num : acc;
+            }
+            break;
+        case IDEARITH_MAX:
+            for (int i=1; i<count; i++) {
+                acc = cells[i]->num > acc ? cells[i]->num : acc;
+            }
+            break;
+    }
+
+    *out = acc;
+    return NULL;
+}
+
+// As idearith_num, for numbers of which at least one is a decimal
+char* idearith_decimal(int op, ideobj** cells, int count, double* out) {
+    double acc = ideobj_decimal_value(cells[0]);
+
+    switch (op) {
+        case IDEARITH_ADD:
+            for (int i=1; i<count; i++) {
+                acc += ideobj_decimal_value(cells[i]);
+            }
+            break;
+        case IDEARITH_SUB:
+            if (count == 1) {
+                acc = -acc;
+            }
+            for (int i=1; i<count; i++) {
+                acc -= ideobj_decimal_value(cells[i]);
+            }
+            break;
+        case IDEARITH_MUL:
+            for (int i=1; i<count; i++) {
+                acc *= ideobj_decimal_value(cells[i]);
+            }
+            break;
+        case IDEARITH_DIV:
+            for (int i=1; i<count; i++) {
+                double value = ideobj_decimal_value(cells[i]);
+                if (value == 0) {
+                    return "Division by zero";
+                }
+                acc /= value;
+            }
+            break;
+        case IDEARITH_MOD:
+            if (count > 1) {
+                return "Invalid operator '%'";
+            }
+            break;
+        case IDEARITH_POW:
+            for (int i=1; i<count; i++) {
+                acc = pow(acc, ideobj_decimal_value(cells[i]));
+            }
+            break;
+        case IDEARITH_MIN:
+            for (int i=1; i<count; i++) {
+                double value = ideobj_decimal_value(cells[i]);
+                acc = value < acc ? value : acc;
+            }
+            break;
+        case IDEARITH_MAX:
+            for (int i=1; i<count; i++) {
+                double value = ideobj_decimal_value(cells[i]);
+                acc = value > acc ? value : acc;
+            }
+            break;
+    }
+
+    *out = acc;
+    return NULL;
+}
+
+// Applies op to count numbers, which the caller keeps. The result is
+// written to reuse when it is given, a number that nothing else holds,
+// and to a new number otherwise.
+ideobj* idearith_apply(int op, ideobj** cells, int count, ideobj* reuse) {
+    int all_num = 1;
+    for (int i=0; i<count; i++) {
+        if (cells[i]->type != IDEOBJ_NUM) {
+            all_num = 0;
+            if (cells[i]->type != IDEOBJ_DECIMAL) {
+                return ideobj_err("Cannot operate on non-number");
+            }
+        }
+    }
+
+    char* err;
+    if (all_num) {
+        long acc;
+        err = idearith_num(op, cells, count, &acc);
+        if (!err) {
+            if (!reuse) {
+                return ideobj_num(acc);
+            }
+            reuse->num = acc;
+            return ideobj_copy(reuse);
+        }
+    } else {
+        double acc;
+        err = idearith_decimal(op, cells, count, &acc);
+        if (!err) {
+            if (!reuse) {
+                return ideobj_decimal(acc);
+            }
+            reuse->type = IDEOBJ_DECIMAL;
+            reuse->decimal = acc;
+            return ideobj_copy(reuse);
+        }
+    }
+
+    return ideobj_err("%s", err);
+}
+
+ideobj* ideobj_list_add(ideobj* left, ideobj* right) {
+    idelist_reserve(left, left->count + 1);
+    left->cell[left->count++] = right;
+    return left;
+}
+
+ideobj* ideobj_pop(ideobj* obj, int i) {
+    if (obj->base) {
+        if (i == 0) {
+            obj->count--;
+            return ideobj_copy(*obj->cell++);
+        }
+        idelist_unview(obj);
+    }
+    idelist_changed(obj);
+
+    ideobj* el = obj->cell[i];
+    obj->count--;
+
+    if (i == 0) {
+        obj->cell++;
+        obj->offset++;
+        return el;
+    }
+
+    memmove(
+        &obj->cell[i], &obj->cell[i+1], sizeof(ideobj*) * (obj->count-i)
+    );
+    return el;
+}
+
+// Releases every cell past the first `count`
+void ideobj_truncate(ideobj* obj, int count) {
+    // A view holds no references of its own
+    if (obj->base) {
+        if (count < obj->count) {
+            obj->count = count;
+        }
+        return;
+    }
+    idelist_changed(obj);
+
+    while (obj->count > count) {
+        ideobj_del(obj->cell[--obj->count]);
+    }
+}
+
+ideobj* ideobj_take(ideobj* obj, int i) {
+    ideobj* el = ideobj_pop(obj, i);
+    ideobj_del(obj);
+    return el;
+}
+
+#define IASSERT(args, cond, format, ...) \
+    if (!(cond)) { \
+        ideobj* error = ideobj_err(format, ##__VA_ARGS__); \
+        ideobj_del(args); \
+        return error; \
     }
 
 #define IASSERT_TYPE(func, args, index, expect) \
@@ -734,12 +2467,19 @@ ideobj* builtin_head(ideenv* env, ideobj* obj) {
         obj, obj->cell[0]->count != 0, "Function 'head' received empty list"
     );
 
-    ideobj* first = ideobj_take(obj, 0);
-    while(first->count > 1) {
-        ideobj_del(
-            ideobj_pop(first, 1)
-        );
+    ideobj* list = ideobj_take(obj, 0);
+    if (list->rc == 1) {
+        ideobj_truncate(list, 1);
+        return list;
     }
+
+    ideobj* first = ideobj_new(list->type);
+    first->count = 0;
+    first->offset = 0;
+    first->cell = NULL;
+    first->base = NULL;
+    ideobj_list_add(first, ideobj_copy(list->cell[0]));
+    ideobj_del(list);
     return first;
 }
 
@@ -748,9 +2488,32 @@ ideobj* builtin_tail(ideenv* env, ideobj* obj) {
     IASSERT_TYPE("tail", obj, 0, IDEOBJ_QEXPR);
     IASSERT_NOT_EMPTY("tail", obj, 0);
 
-    ideobj* first = ideobj_take(obj, 0);
-    ideobj_del(ideobj_pop(first, 0));
-    return first;
+    // The tail of a shared list is a view of its cells, not a copy
+    ideobj* list = ideobj_take(obj, 0);
+    if (list->rc > 1) {
+        return idelist_view(list, 1, list->count - 1);
+    }
+
+    ideobj_del(ideobj_pop(list, 0));
+    return list;
+}
+
+ideobj* ideobj_unwrap(ideenv* env, ideobj* elem);
+
+ideobj* builtin_nth(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("nth", obj, 2);
+    IASSERT_TYPE("nth", obj, 0, IDEOBJ_NUM);
+    IASSERT_TYPE("nth", obj, 1, IDEOBJ_QEXPR);
+    IASSERT(
+        obj,
+        obj->cell[0]->num >= 0 && obj->cell[0]->num < obj->cell[1]->count,
+        "Function 'nth' passed index %li, out of range for length %i.",
+        obj->cell[0]->num, obj->cell[1]->count
+    );
+
+    ideobj* value = ideobj_unwrap(env, obj->cell[1]->cell[obj->cell[0]->num]);
+    ideobj_del(obj);
+    return value;
 }
 
 ideobj* builtin_list(ideenv* env, ideobj* obj) {
@@ -762,7 +2525,7 @@ ideobj* builtin_str_split(ideenv* env, ideobj *obj) {
     ideobj *list = ideobj_qexpr();
     char* source = obj->cell[0]->str;
 
-    list->cell = malloc(sizeof(ideobj) * strlen(source));
+    idelist_reserve(list, strlen(source));
     list->count = strlen(source);
 
     for (int i=0; i<strlen(source); i++) {
@@ -807,18 +2570,289 @@ ideobj* builtin_str_lowercase(ideenv* env, ideobj *obj) {
     return ideobj_str(ucase_str);
 }
 
-ideobj* ideobj_hashmap_add(ideobj* hm, ideobj* key, ideobj* val) {
-    hm->count++;
+idestack idehash_stack;
+
+// Structural hash, equal objects by ideobj_eq hash the same. Lists and
+// functions are folded in from a stack in the order ideobj_eq visits
+// them, so nesting is only bounded by memory.
+unsigned long idehash_obj(ideobj* obj) {
+    int base = idehash_stack.count;
+    unsigned long hash = 0;
+
+    while (1) {
+        unsigned long part = obj->type;
+
+        switch (obj->type) {
+            case IDEOBJ_NUM:
+                part = obj->num;
+                break;
+            case IDEOBJ_DECIMAL:
+                // Decimals are equal within a tolerance, which no hash can
+                // follow, so they all share one
+                break;
+            case IDEOBJ_ERR:
+                part = idehash_str(obj->err);
+                break;
+            case IDEOBJ_STR:
+                part = idehash_str(obj->str);
+                break;
+            case IDEOBJ_SYMBOL:
+                part = idehash_ptr(obj->symbol);
+                break;
+            case IDEOBJ_KEYWORD:
+                part = idehash_ptr(obj->keyword);
+                break;
+            case IDEOBJ_BUILTIN:
+                part = (uintptr_t) obj->builtin;
+                break;
+            case IDEOBJ_SEQ:
+                part = (uintptr_t) obj;
+                break;
+            case IDEOBJ_FUN:
+                idestack_push(&idehash_stack, obj->body);
+                idestack_push(&idehash_stack, obj->params);
+                break;
+            case IDEOBJ_QEXPR:
+            case IDEOBJ_SEXPR:
+                // Pushed last to first so that cells are popped in order
+                part = part * 31 + obj->count;
+                for (int i=obj->count-1; i>=0; i--) {
+                    idestack_push(&idehash_stack, obj->cell[i]);
+                }
+                break;
+            case IDEOBJ_HASHMAP: {
+                // Summed, so that entry order does not matter
+                ideslot** entries = idemap_entries(obj);
+                for (int i=0; i<obj->size; i++) {
+                    part += entries[i]->hash * 31 + idehash_obj(entries[i]->val);
+                }
+                free(entries);
+                break;
+            }
+        }
+
+        hash = hash * 31 + idehash_ptr((void*) (uintptr_t) (part ^ obj->type));
+
+        if (idehash_stack.count == base) {
+            break;
+        }
+        obj = idehash_stack.items[--idehash_stack.count];
+    }
+
+    return hash;
+}
+
+int idenode_pos(idenode* node, unsigned int bit) {
+    return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+// Returns the entry for key below node, or NULL
+ideslot* idenode_find(idenode* node, ideobj* key, unsigned long hash) {
+    int shift = 0;
+
+    while (node) {
+        if (node->collision) {
+            for (int i=0; i<node->count; i++) {
+                ideslot* slot = &node->slots[i];
+                if (slot->hash == hash && ideobj_eq(key, slot->key)) {
+                    return slot;
+                }
+            }
+            return NULL;
+        }
+
+        unsigned int bit = 1u << ((hash >> shift) & IDENODE_MASK);
+        if (!(node->bitmap & bit)) {
+            return NULL;
+        }
+
+        ideslot* slot = &node->slots[idenode_pos(node, bit)];
+        if (slot->key) {
+            if (slot->hash == hash && ideobj_eq(key, slot->key)) {
+                return slot;
+            }
+            return NULL;
+        }
+
+        node = slot->node;
+        shift += IDENODE_BITS;
+    }
+
+    return NULL;
+}
+
+ideslot* idemap_find(ideobj* hm, ideobj* key) {
+    return idenode_find(hm->root, key, idehash_obj(key));
+}
+
+// Returns a node holding entries a and b, which share the hash bits
+// above shift
+idenode* idenode_pair(ideslot a, ideslot b, int shift) {
+    if (a.hash == b.hash) {
+        idenode* node = idenode_new(2, 1);
+        node->slots[0] = a;
+        node->slots[1] = b;
+        return node;
+    }
+
+    unsigned int a_bits = (a.hash >> shift) & IDENODE_MASK;
+    unsigned int b_bits = (b.hash >> shift) & IDENODE_MASK;
+
+    if (a_bits == b_bits) {
+        idenode* node = idenode_new(1, 0);
+        node->bitmap = 1u << a_bits;
+        node->slots[0].key = NULL;
+        node->slots[0].node = idenode_pair(a, b, shift + IDENODE_BITS);
+        return node;
+    }
+
+    idenode* node = idenode_new(2, 0);
+    node->bitmap = (1u << a_bits) | (1u << b_bits);
+    node->slots[a_bits < b_bits ? 0 : 1] = a;
+    node->slots[a_bits < b_bits ? 1 : 0] = b;
+    return node;
+}
+
+// Inserts entry below *ref, copying shared nodes on the way down. Returns
+// 1 when the key is new, otherwise the old value is replaced and the
+// entry's key released.
+int idenode_assoc(idenode** ref, ideslot entry, int shift) {
+    idenode* node = *ref = idenode_own(*ref);
+
+    if (node->collision) {
+        if (entry.hash == node->slots[0].hash) {
+            for (int i=0; i<node->count; i++) {
+                if (ideobj_eq(entry.key, node->slots[i].key)) {
+                    ideobj_del(node->slots[i].val);
+                    ideobj_del(entry.key);
+                    node->slots[i].val = entry.val;
+                    return 0;
+                }
+            }
+
+            node = realloc(
+                node, sizeof(idenode) + sizeof(ideslot) * (node->count + 1)
+            );
+            node->slots[node->count++] = entry;
+            *ref = node;
+            return 1;
+        }
+
+        // A different hash ends up here, branch above the collision
+        idenode* branch = idenode_new(1, 0);
+        branch->bitmap = 1u << ((node->slots[0].hash >> shift) & IDENODE_MASK);
+        branch->slots[0].key = NULL;
+        branch->slots[0].node = node;
+        *ref = branch;
+        return idenode_assoc(ref, entry, shift);
+    }
 
-    hm->keys = realloc(hm->keys, sizeof(ideobj*) * hm->count);
-    hm->keys[hm->count-1] = key;
+    unsigned int bit = 1u << ((entry.hash >> shift) & IDENODE_MASK);
+    int pos = idenode_pos(node, bit);
 
-    hm->cell = realloc(hm->cell, sizeof(ideobj*) * hm->count);
-    hm->cell[hm->count-1] = val;
+    if (!(node->bitmap & bit)) {
+        node = realloc(
+            node, sizeof(idenode) + sizeof(ideslot) * (node->count + 1)
+        );
+        memmove(
+            &node->slots[pos+1],
+            &node->slots[pos],
+            sizeof(ideslot) * (node->count - pos)
+        );
+        node->slots[pos] = entry;
+        node->count++;
+        node->bitmap |= bit;
+        *ref = node;
+        return 1;
+    }
+
+    ideslot* slot = &node->slots[pos];
+    if (!slot->key) {
+        return idenode_assoc(&slot->node, entry, shift + IDENODE_BITS);
+    }
+
+    if (slot->hash == entry.hash && ideobj_eq(entry.key, slot->key)) {
+        ideobj_del(slot->val);
+        ideobj_del(entry.key);
+        slot->val = entry.val;
+        return 0;
+    }
+
+    slot->node = idenode_pair(*slot, entry, shift + IDENODE_BITS);
+    slot->key = NULL;
+    return 1;
+}
+
+// Removes key, which must be present, below *ref
+void idenode_dissoc(idenode** ref, ideobj* key, unsigned long hash, int shift) {
+    idenode* node = *ref = idenode_own(*ref);
+    int pos = 0;
+
+    if (node->collision) {
+        while (!ideobj_eq(key, node->slots[pos].key)) {
+            pos++;
+        }
+    } else {
+        unsigned int bit = 1u << ((hash >> shift) & IDENODE_MASK);
+        pos = idenode_pos(node, bit);
+
+        ideslot* slot = &node->slots[pos];
+        if (!slot->key) {
+            idenode_dissoc(&slot->node, key, hash, shift + IDENODE_BITS);
+
+            // A child left with a single entry is folded back into its
+            // slot, it is unshared after idenode_own
+            idenode* child = slot->node;
+            if (child->count == 1 && child->slots[0].key) {
+                *slot = child->slots[0];
+                free(child);
+            }
+            return;
+        }
+
+        node->bitmap &= ~bit;
+    }
+
+    ideobj_del(node->slots[pos].key);
+    ideobj_del(node->slots[pos].val);
+    memmove(
+        &node->slots[pos],
+        &node->slots[pos+1],
+        sizeof(ideslot) * (node->count - pos - 1)
+    );
+    node->count--;
+}
 
+// Sets key to val in hm, which must be unshared. Takes ownership of both,
+// an existing key keeps its place in the insertion order.
+ideobj* ideobj_hashmap_add(ideobj* hm, ideobj* key, ideobj* val) {
+    if (!hm->root) {
+        hm->root = idenode_new(0, 0);
+    }
+
+    ideslot entry = {
+        .key = key, .val = val, .hash = idehash_obj(key), .stamp = hm->stamp
+    };
+
+    if (idenode_assoc(&hm->root, entry, 0)) {
+        hm->size++;
+        hm->stamp++;
+    }
     return hm;
 }
 
+// Removes key from hm, which must be unshared. Returns 0 when it is missing
+int ideobj_hashmap_remove(ideobj* hm, ideobj* key) {
+    unsigned long hash = idehash_obj(key);
+    if (!idenode_find(hm->root, key, hash)) {
+        return 0;
+    }
+
+    idenode_dissoc(&hm->root, key, hash, 0);
+    hm->size--;
+    return 1;
+}
+
 ideobj* builtin_hashmap(ideenv* env, ideobj* obj) {
     IASSERT_NUM("hash-map", obj, 1);
     IASSERT_TYPE("hash-map", obj, 0, IDEOBJ_QEXPR);
@@ -829,20 +2863,13 @@ ideobj* builtin_hashmap(ideenv* env, ideobj* obj) {
     }
 
     ideobj *hm = ideobj_hashmap();
+    obj->cell[0] = ideobj_cow(obj->cell[0]);
 
     while (obj->cell[0]->count) {
         ideobj *key = ideobj_pop(obj->cell[0], 0);
         ideobj *value = ideobj_pop(obj->cell[0], 0);
 
         ideobj_hashmap_add(hm, key, value);
-
-        // hm->count++;
-
-        // hm->keys = realloc(hm->keys, sizeof(ideobj*) * hm->count);
-        // hm->keys[hm->count-1] = key;
-
-        // hm->cell = realloc(hm->cell, sizeof(ideobj*) * hm->count);
-        // hm->cell[hm->count-1] = value;
     }
 
     ideobj_del(obj);
@@ -857,14 +2884,13 @@ ideobj* builtin_hashmap_key(ideenv* env, ideobj* obj) {
     ideobj *hm = ideobj_pop(obj, 0);
     ideobj *key = ideobj_pop(obj, 0);
 
-     for (int i=0; i<hm->count; i++) {
-         if (ideobj_eq(key, hm->keys[i])) {
-             ideobj_del(obj);
-             return hm->cell[i];
-         }
-     }
+    ideslot* entry = idemap_find(hm, key);
+    ideobj *val = entry ? ideobj_copy(entry->val) : NULL;
 
-    return ideobj_err("Key not found");
+    ideobj_del(hm);
+    ideobj_del(key);
+    ideobj_del(obj);
+    return val ? val : ideobj_err("Key not found");
 }
 
 ideobj* builtin_hashmap_assoc(ideenv* env, ideobj* obj) {
@@ -873,41 +2899,10 @@ ideobj* builtin_hashmap_assoc(ideenv* env, ideobj* obj) {
 
     ideobj *key = ideobj_pop(obj, 0);
     ideobj *val = ideobj_pop(obj, 0);
-    ideobj *hm = ideobj_pop(obj, 0);
-
-    for (int i=0; i<hm->count; i++) {
-        if (ideobj_eq(key, hm->keys[i])) {
-            ideobj_del(obj);
-            hm->cell[i] = ideobj_copy(val);
-            return hm;
-        }
-    }
-
-    ideobj_hashmap_add(hm, key, val);
-    return hm;
-}
-
-ideobj* ideobj_hashmap_take(ideobj *obj, int i, char* return_type) {
-    ideobj* key = obj->keys[i];
-    ideobj* val = obj->cell[i];
-
-    memmove(
-        &obj->keys[i], &obj->keys[i+1], sizeof(ideobj*) * (obj->count-i-1)
-    );
-    memmove(
-        &obj->cell[i], &obj->cell[i+1], sizeof(ideobj*) * (obj->count-i-1)
-    );
-
-    obj->count--;
-    obj->keys= realloc(obj->keys, sizeof(ideobj*) * obj->count);
-    obj->cell = realloc(obj->cell, sizeof(ideobj*) * obj->count);
-
-    if (strcmp(return_type, "key") == 0) {
-        return key;
-    }
-
+    ideobj *hm = ideobj_cow(ideobj_pop(obj, 0));
     ideobj_del(obj);
-    return val;
+
+    return ideobj_hashmap_add(hm, key, val);
 }
 
 ideobj* builtin_hashmap_deassoc(ideenv* env, ideobj* obj) {
@@ -915,38 +2910,18 @@ ideobj* builtin_hashmap_deassoc(ideenv* env, ideobj* obj) {
     IASSERT_TYPE("dassoc", obj, 1, IDEOBJ_HASHMAP);
 
     ideobj *key = ideobj_pop(obj, 0);
-    ideobj *hm = ideobj_pop(obj, 0);
+    ideobj *hm = ideobj_cow(ideobj_pop(obj, 0));
+    ideobj_del(obj);
 
-    int index = -1;
+    int found = ideobj_hashmap_remove(hm, key);
+    ideobj_del(key);
 
-    for (int i=0; i<hm->count; i++) {
-        if (ideobj_eq(key, hm->keys[i])) {
-            index = i;
-            break;
-        }
-    }
-
-    if (index == -1) {
+    if (!found) {
+        ideobj_del(hm);
         return ideobj_err("Key not found in hashmap");
     }
 
-    memmove(
-        &hm->keys[index],
-        &hm->keys[index+1],
-        sizeof(ideobj*) * (hm->count-index-1)
-    );
-
-    memmove(
-        &hm->cell[index],
-        &hm->cell[index+1],
-        sizeof(ideobj*) * (hm->count-index-1)
-    );
-
-    hm->count--;
-    hm->keys = realloc(hm->keys, sizeof(ideobj*) * hm->count);
-    hm->cell = realloc(hm->cell, sizeof(ideobj*) * hm->count);
     return hm;
-
 }
 
 ideobj* builtin_str(ideenv* env, ideobj *obj) {
@@ -997,22 +2972,71 @@ ideobj* builtin_eval(ideenv* env, ideobj* obj) {
         "Function 'eval' received wrong type"
     );
 
-    ideobj* first = ideobj_take(obj, 0);
+    ideobj* first = ideobj_cow(ideobj_take(obj, 0));
 
     first->type = IDEOBJ_SEXPR;
     return ideobj_eval(env, first);
 }
 
 ideobj* ideobj_join(ideobj* left, ideobj* right) {
+    // Joining onto a longer unshared list moves left in front of it, so
+    // building a list from the back is linear
+    if (right->rc == 1 && !right->base && left->count < right->count) {
+        idelist_reserve_front(right, left->count);
+        right->cell -= left->count;
+        right->offset -= left->count;
+        right->count += left->count;
+        right->type = left->type;
+
+        for (int i=0; i<left->count; i++) {
+            right->cell[i] = ideobj_copy(left->cell[i]);
+        }
+
+        ideobj_del(left);
+        return right;
+    }
+
+    if (right->rc > 1 || right->base) {
+        idelist_reserve(left, left->count + right->count);
+        for (int i = 0; i < right->count; i++) {
+            left = ideobj_list_add(left, ideobj_copy(right->cell[i]));
+        }
+
+        ideobj_del(right);
+        return left;
+    }
+
+    idelist_reserve(left, left->count + right->count);
     for (int i = 0; i < right->count; i++) {
         left = ideobj_list_add(left, right->cell[i]);
     }
 
-    free(right->cell);
-    free(right);
+    idelist_free(right);
+    ideobj_free(right);
     return left;
 }
 
+// Returns a string of count strings joined in order, copied once
+ideobj* idestr_join(ideobj** strs, int count) {
+    size_t length = 0;
+    for (int i=0; i<count; i++) {
+        length += strlen(strs[i]->str);
+    }
+
+    char* source = malloc(length + 1);
+    char* end = source;
+    for (int i=0; i<count; i++) {
+        size_t part = strlen(strs[i]->str);
+        memcpy(end, strs[i]->str, part);
+        end += part;
+    }
+    *end = '\0';
+
+    ideobj* joined = ideobj_new(IDEOBJ_STR);
+    joined->str = source;
+    return joined;
+}
+
 ideobj* builtin_concat(ideenv* env, ideobj* obj) {
     for (int i=0; i<obj->count; i++) {
         IASSERT(
@@ -1022,30 +3046,7 @@ ideobj* builtin_concat(ideenv* env, ideobj* obj) {
         );
     }
 
-    ideobj* left = ideobj_pop(obj, 0);
-
-    char *source = malloc(strlen(left->str) + 1);
-    strcpy(source, left->str);
-
-    ideobj_del(left);
-
-    while(obj->count) {
-        ideobj* right = ideobj_pop(obj, 0);
-
-        char *combined = malloc(strlen(source) + strlen(right->str) + 1);
-        strcpy(combined, source);
-        strcat(combined, right->str);
-
-        source = malloc(strlen(combined) + 1);
-        strcpy(source, combined);
-
-        free(combined);
-        ideobj_del(right);
-    }
-
-    ideobj* concat = ideobj_str(source);
-
-    free(source);
+    ideobj* concat = idestr_join(obj->cell, obj->count);
     ideobj_del(obj);
     return concat;
 }
@@ -1069,17 +3070,24 @@ ideobj* builtin_type(ideenv* env, ideobj* obj) {
     return type;
 }
 
+ideobj* ideseq_len(ideenv* env, ideobj* obj);          // Forward declaration
+
 ideobj* builtin_len(ideenv* env, ideobj* obj) {
     IASSERT_NUM("len", obj, 1);
 
     ideobj *len_obj;
 
     switch (obj->cell[0]->type) {
+        case IDEOBJ_SEQ:
+            len_obj = ideseq_len(env, obj->cell[0]);
+            break;
         case IDEOBJ_SEXPR:
         case IDEOBJ_QEXPR:
-        case IDEOBJ_HASHMAP:
             len_obj = ideobj_num(obj->cell[0]->count);
             break;
+        case IDEOBJ_HASHMAP:
+            len_obj = ideobj_num(obj->cell[0]->size);
+            break;
         case IDEOBJ_STR:
             len_obj = ideobj_num(strlen(obj->cell[0]->str));
             break;
@@ -1094,81 +3102,92 @@ ideobj* builtin_len(ideenv* env, ideobj* obj) {
     return len_obj;
 }
 
-ideobj* builtin_join(ideenv* env, ideobj* obj) {
-    for (int i=0; i<obj->count; i++) {
-        IASSERT_TYPE("join", obj, i, IDEOBJ_QEXPR);
-    }
-
-    ideobj* first = ideobj_pop(obj, 0);
-    while(obj->count) {
-        first = ideobj_join(first, ideobj_pop(obj, 0));
-    }
+ideobj* ideslab_stats(ideslab* slab) {
+    ideobj* stats = ideobj_hashmap();
+    double hit_rate = slab->allocs ? (double) slab->hits / slab->allocs : 0;
 
-    ideobj_del(obj);
-    return first;
+    ideobj_hashmap_add(stats, ideobj_keyword("allocs"), ideobj_num(slab->allocs));
+    ideobj_hashmap_add(stats, ideobj_keyword("hits"), ideobj_num(slab->hits));
+    ideobj_hashmap_add(stats, ideobj_keyword("hit-rate"), ideobj_decimal(hit_rate));
+    ideobj_hashmap_add(
+        stats, ideobj_keyword("live"), ideobj_num(slab->allocs - slab->frees)
+    );
+    ideobj_hashmap_add(stats, ideobj_keyword("blocks"), ideobj_num(slab->blocks));
+    return stats;
 }
 
-ideobj* builtin_op_num(ideenv* env, ideobj* obj, char* operator) {
-    ideobj* acc_value = ideobj_pop(obj, 0);
+ideobj* builtin_alloc_stats(ideenv* env, ideobj* obj) {
+    ideobj* stats = ideobj_hashmap();
 
-    if (strcmp(operator, "-") == 0 && obj->count == 0) {
-        acc_value->num = -acc_value->num;
-    }
+    ideobj_hashmap_add(stats, ideobj_keyword("obj"), ideslab_stats(&ideobj_slab));
+    ideobj_hashmap_add(stats, ideobj_keyword("env"), ideslab_stats(&ideenv_slab));
 
-    while(obj->count > 0) {
-        ideobj* right = ideobj_pop(obj, 0);
-        acc_value = eval_tenary_number_op(acc_value, operator, right);
-        ideobj_del(right);
-    }
+    ideobj* nursery_stats = ideobj_hashmap();
+    ideobj_hashmap_add(nursery_stats, ideobj_keyword("bumps"), ideobj_num(nursery.bumps));
+    ideobj_hashmap_add(
+        nursery_stats, ideobj_keyword("promotions"), ideobj_num(nursery.promotions)
+    );
+    ideobj_hashmap_add(
+        nursery_stats, ideobj_keyword("survivors"), ideobj_num(nursery.survivors)
+    );
+    ideobj_hashmap_add(
+        nursery_stats, ideobj_keyword("recycled"), ideobj_num(nursery.recycled)
+    );
+    ideobj_hashmap_add(stats, ideobj_keyword("nursery"), nursery_stats);
 
     ideobj_del(obj);
-    return acc_value;
+    return stats;
 }
 
-ideobj* builtin_op_decimal(ideenv* env, ideobj* obj, char* operator) {
-    ideobj* acc_value = ideobj_pop(obj, 0);
-
-    if (strcmp(operator, "-") == 0 && obj->count == 0) {
-        acc_value->decimal = -acc_value->decimal;
-    }
+ideobj* builtin_gc_stats(ideenv* env, ideobj* obj) {
+    ideobj* stats = ideobj_hashmap();
+    long live_objs = ideobj_slab.allocs - ideobj_slab.frees;
+    long live_envs = ideenv_slab.allocs - ideenv_slab.frees;
+    long live_bytes = live_objs * sizeof(ideobj) + live_envs * sizeof(ideenv);
 
-    while(obj->count > 0) {
-         ideobj* right = ideobj_pop(obj, 0);
-         acc_value = eval_tenary_decimal_op(acc_value, operator, right);
-         ideobj_del(right);
-    }
+    ideobj_hashmap_add(stats, ideobj_keyword("collections"), ideobj_num(gc.collections));
+    ideobj_hashmap_add(stats, ideobj_keyword("freed"), ideobj_num(gc.freed));
+    ideobj_hashmap_add(stats, ideobj_keyword("pause-total-ms"), ideobj_decimal(gc.pause_total));
+    ideobj_hashmap_add(stats, ideobj_keyword("pause-max-ms"), ideobj_decimal(gc.pause_max));
+    ideobj_hashmap_add(stats, ideobj_keyword("live-bytes"), ideobj_num(live_bytes));
 
     ideobj_del(obj);
-    return acc_value;
+    return stats;
 }
 
-int ideobj_cells_is_type(ideobj* obj, int type) {
+ideobj* builtin_join(ideenv* env, ideobj* obj) {
     for (int i=0; i<obj->count; i++) {
-        if (obj->cell[i]->type != type) {
-            return 0;
-        }
+        IASSERT_TYPE("join", obj, i, IDEOBJ_QEXPR);
     }
 
-    return 1;
-}
-
-ideobj* builtin_op(ideenv* env, ideobj* obj, char* operator) {
-    if (ideobj_cells_is_type(obj, IDEOBJ_NUM)) {
-        return builtin_op_num(env, obj, operator);
+    ideobj* first = ideobj_cow(ideobj_pop(obj, 0));
+    while(obj->count) {
+        first = ideobj_join(first, ideobj_pop(obj, 0));
     }
 
-    if (ideobj_is_numeric(obj->cell[0])) {
-        return builtin_op_decimal(env, obj, operator);
-    }
+    ideobj_del(obj);
+    return first;
+}
+
+ideobj* builtin_op(ideenv* env, ideobj* obj, int op) {
+    IASSERT(
+        obj,
+        obj->count > 0,
+        "Function '%s' passed no arguments", idearith_names[op]
+    );
 
-    return ideobj_err("Cannot operate on non-number");
+    ideobj* result = idearith_apply(op, obj->cell, obj->count, NULL);
+    ideobj_del(obj);
+    return result;
 }
 
 int is_approved_symbol(ideobj* obj) {
     return obj->type == IDEOBJ_SYMBOL || obj->type == IDEOBJ_KEYWORD;
 }
 
-ideobj* builtin_var(ideenv* env, ideobj* obj, char* func) {
+// Binds the keys to the values, in the global env for def and in the
+// calling one for defl
+ideobj* builtin_var(ideenv* env, ideobj* obj, char* func, int global) {
     IASSERT_NUM(func, obj, 2);
 
     ideobj* keys = obj->cell[0];
@@ -1180,26 +3199,19 @@ ideobj* builtin_var(ideenv* env, ideobj* obj, char* func) {
 
     // Single
     if (keys->type != IDEOBJ_QEXPR) {
-        ideobj* key = keys;
-        ideobj* value = values;
-
-        if (strcmp(func, "def") == 0) {
-            ideenv_global_put(env, key, value);
-        }
-
-        if (strcmp(func, "defl") == 0) {
-            ideenv_put(env, key, value);
+        if (global) {
+            ideenv_global_put(env, keys, values);
+        } else {
+            ideenv_put(env, keys, values);
         }
     } else {
         for (int i=0; i<keys->count; i++) {
             ideobj* key = keys->cell[i];
             ideobj* value = values->cell[i];
 
-            if (strcmp(func, "def") == 0) {
+            if (global) {
                 ideenv_global_put(env, key, value);
-            }
-
-            if (strcmp(func, "defl") == 0) {
+            } else {
                 ideenv_put(env, key, value);
             }
         }
@@ -1211,11 +3223,11 @@ ideobj* builtin_var(ideenv* env, ideobj* obj, char* func) {
 }
 
 ideobj* builtin_def(ideenv* env, ideobj* obj) {
-    return builtin_var(env, obj, "def");
+    return builtin_var(env, obj, "def", 1);
 }
 
 ideobj* builtin_defl(ideenv* env, ideobj* obj) {
-    return builtin_var(env, obj, "defl");
+    return builtin_var(env, obj, "defl", 0);
 }
 
 ideobj* builtin_let(ideenv* env, ideobj* obj) {
@@ -1229,8 +3241,6 @@ ideobj* builtin_let(ideenv* env, ideobj* obj) {
         "let must recieve same number of keywords as values"
     );
 
-    ideenv* local_env = ideenv_new_enclosed(env);
-
     for (int i=0; i<obj->cell[0]->count; i++) {
         IASSERT(
             obj,
@@ -1241,6 +3251,11 @@ ideobj* builtin_let(ideenv* env, ideobj* obj) {
         );
     }
 
+    idescope scope = { obj->cell[0], 0, NULL };
+    ideobj_resolve(obj->cell[2], &scope, ideenv_global(env));
+
+    ideenv* local_env = ideenv_new_enclosed(env);
+
     for (int i=0; i<obj->cell[0]->count; i++) {
         ideenv_put(
             local_env,
@@ -1249,13 +3264,19 @@ ideobj* builtin_let(ideenv* env, ideobj* obj) {
         );
     }
 
-    return builtin_eval(
+    idegc_push(local_env);
+    ideobj* result = builtin_eval(
         local_env,
         ideobj_list_add(
             ideobj_sexpr(),
             ideobj_copy(obj->cell[2])
         )
     );
+    idegc_pop();
+
+    ideenv_del(local_env);
+    ideobj_del(obj);
+    return result;
 }
 
 ideobj* builtin_fn(ideenv* env, ideobj* obj) {
@@ -1277,8 +3298,11 @@ ideobj* builtin_fn(ideenv* env, ideobj* obj) {
     ideobj* body = ideobj_pop(obj, 0);
     ideobj_del(obj);
 
+    idescope scope = { params, 0, NULL };
+    ideobj_resolve(body, &scope, ideenv_global(env));
+
     ideobj *fn = ideobj_fun(params, body);
-    fn->env->parent = env;
+    fn->env->parent = ideenv_retain(env);
     fn->env->depth = env->depth + 1;
     return fn;
 }
@@ -1292,9 +3316,13 @@ ideobj* builtin_defn(ideenv* env, ideobj* obj) {
     ideobj* name = ideobj_pop(obj, 0);
     ideobj* params = ideobj_pop(obj, 0);
     ideobj* body = ideobj_pop(obj, 0);
+
+    idescope scope = { params, 0, NULL };
+    ideobj_resolve(body, &scope, ideenv_global(env));
+
     ideobj* fn = ideobj_fun(params, body);
 
-    fn->env->parent = env;
+    fn->env->parent = ideenv_retain(env);
     fn->env->depth = env->depth + 1;
 
     ideenv_global_put(env, name, fn);
@@ -1310,7 +3338,17 @@ ideobj* builtin_exit(ideenv* env, ideobj* obj) {
     exit(0);
 }
 
+ideobj* ideobj_realize(ideenv* env, ideobj* obj);     // Forward declaration
+
 ideobj* builtin_print(ideenv* env, ideobj* obj) {
+    // Sequences are printed as the list of their elements
+    for (int i=0; i<obj->count; i++) {
+        obj->cell[i] = ideobj_realize(env, obj->cell[i]);
+        if (obj->cell[i]->type == IDEOBJ_ERR) {
+            return ideobj_take(obj, i);
+        }
+    }
+
     for (int i=0; i<obj->count; i++) {
         ideobj_print(obj->cell[i]);
         putchar(' ');
@@ -1322,151 +3360,191 @@ ideobj* builtin_print(ideenv* env, ideobj* obj) {
 }
 
 ideobj* builtin_add(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "+");
+    return builtin_op(env, obj, IDEARITH_ADD);
 }
 
 ideobj* builtin_sub(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "-");
+    return builtin_op(env, obj, IDEARITH_SUB);
 }
 
 ideobj* builtin_mul(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "*");
+    return builtin_op(env, obj, IDEARITH_MUL);
 }
 
 ideobj* builtin_div(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "/");
+    return builtin_op(env, obj, IDEARITH_DIV);
 }
 
 ideobj* builtin_mod(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "%");
+    return builtin_op(env, obj, IDEARITH_MOD);
 }
 
 ideobj* builtin_pow(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "^");
+    return builtin_op(env, obj, IDEARITH_POW);
 }
 
 ideobj* builtin_min(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "min");
+    return builtin_op(env, obj, IDEARITH_MIN);
 }
 
 ideobj* builtin_max(ideenv* env, ideobj* obj) {
-    return builtin_op(env, obj, "max");
+    return builtin_op(env, obj, IDEARITH_MAX);
 }
 
-ideobj* builtin_ord_num(ideenv *env, ideobj* obj, char* operator) {
-    ideobj* left = ideobj_pop(obj, 0);
-    ideobj* right = ideobj_pop(obj, 0);
-
-    int status;
-    if (strcmp(operator, ">") == 0) {
-        status = left->num > right->num;
-    }
-
-    if (strcmp(operator, ">=") == 0) {
-        status = left->num >= right->num;
-    }
-
-    if (strcmp(operator, "<") == 0) {
-        status = left->num < right->num;
-    }
-
-    if (strcmp(operator, "<=") == 0) {
-        status = left->num <= right->num;
+int ideord_num(int op, long left, long right) {
+    switch (op) {
+        case IDEARITH_GT: return left > right;
+        case IDEARITH_GTE: return left >= right;
+        case IDEARITH_LT: return left < right;
+        case IDEARITH_LTE: return left <= right;
     }
-
-    ideobj_del(obj);
-    return ideobj_num(status);
+    return 0;
 }
 
-ideobj* builtin_ord_decimal(ideenv *env, ideobj* obj, char* operator) {
-    ideobj* left = ideobj_pop(obj, 0);
-    ideobj* right = ideobj_pop(obj, 0);
-
-    double left_value = left->decimal;
-    double right_value = right->decimal;
-
-    if (left->type == IDEOBJ_NUM) {
-        left_value = (double) left->num;
-    }
-
-    if (right->type == IDEOBJ_NUM) {
-        right_value = (double) right->num;
-    }
-
-    int status;
-    if (strcmp(operator, ">") == 0) {
-        status = left_value > right_value;
+int ideord_decimal(int op, double left, double right) {
+    switch (op) {
+        case IDEARITH_GT: return left > right;
+        case IDEARITH_GTE: return left >= right;
+        case IDEARITH_LT: return left < right;
+        case IDEARITH_LTE: return left <= right;
     }
+    return 0;
+}
 
-    if (strcmp(operator, ">=") == 0) {
-        status = left_value >= right_value;
-    }
+// Compares each argument with the next, true when every pair is ordered
+// by op, so (< 1 2 3) checks 1 < 2 and 2 < 3
+ideobj* builtin_ord(ideenv *env, ideobj* obj, int op) {
+    IASSERT(
+        obj,
+        obj->count >= 2,
+        "Function '%s' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or more.",
+        idearith_names[op], obj->count
+    );
 
-    if (strcmp(operator, "<") == 0) {
-        status = left_value < right_value;
+    for (int i=0; i<obj->count; i++) {
+        if (!ideobj_is_numeric(obj->cell[i])) {
+            ideobj_del(obj);
+            return ideobj_err(
+                "Cannot %s operate on non-number", idearith_names[op]
+            );
+        }
     }
 
-    if (strcmp(operator, "<=") == 0) {
-        status = left_value <= right_value;
+    int status = 1;
+    for (int i=0; i<obj->count - 1 && status; i++) {
+        ideobj* left = obj->cell[i];
+        ideobj* right = obj->cell[i + 1];
+        if (left->type == IDEOBJ_NUM && right->type == IDEOBJ_NUM) {
+            status = ideord_num(op, left->num, right->num);
+        } else {
+            status = ideord_decimal(
+                op, ideobj_decimal_value(left), ideobj_decimal_value(right)
+            );
+        }
     }
 
     ideobj_del(obj);
     return ideobj_num(status);
 }
 
-ideobj* builtin_ord(ideenv *env, ideobj* obj, char* operator) {
-    if (ideobj_cells_is_type(obj, IDEOBJ_NUM)) {
-        return builtin_ord_num(env, obj, operator);
-    }
-
-    if (ideobj_is_numeric(obj->cell[0])) {
-        return builtin_ord_decimal(env, obj, operator);
-    }
-
-    return ideobj_err("Cannot %s operate on non-number", operator);
-}
-
 ideobj* builtin_gt(ideenv* env, ideobj* obj) {
-    return builtin_ord(env, obj, ">");
+    return builtin_ord(env, obj, IDEARITH_GT);
 }
 
 ideobj* builtin_gte(ideenv* env, ideobj* obj) {
-    return builtin_ord(env, obj, ">=");
+    return builtin_ord(env, obj, IDEARITH_GTE);
 }
 
 ideobj* builtin_lt(ideenv* env, ideobj* obj) {
-    return builtin_ord(env, obj, "<");
+    return builtin_ord(env, obj, IDEARITH_LT);
 }
 
 ideobj* builtin_lte(ideenv* env, ideobj* obj) {
-    return builtin_ord(env, obj, "<=");
+    return builtin_ord(env, obj, IDEARITH_LTE);
 }
 
-ideobj* builtin_cmp(ideenv* env, ideobj* obj, char* operator) {
-    IASSERT_NUM(operator, obj, 2);
-
-    ideobj* left = ideobj_pop(obj, 0);
-    ideobj* right = ideobj_pop(obj, 0);
-
-    int status;
-    if (strcmp(operator, "==") == 0) {
-        status = ideobj_eq(left, right);
-    }
+ideobj* builtin_cmp(ideenv* env, ideobj* obj, int op) {
+    IASSERT_NUM(idearith_names[op], obj, 2);
 
-    if (strcmp(operator, "!=") == 0) {
-        status = ideobj_eq(left, right) == 0;
-    }
+    int equal = ideobj_eq(obj->cell[0], obj->cell[1]);
+    int status = op == IDEARITH_EQ ? equal : !equal;
 
     ideobj_del(obj);
     return ideobj_num(status);
 }
 
 ideobj* builtin_eq(ideenv* env, ideobj* obj) {
-    return builtin_cmp(env, obj, "==");
+    return builtin_cmp(env, obj, IDEARITH_EQ);
 }
 
 ideobj* builtin_neq(ideenv* env, ideobj* obj) {
-    return builtin_cmp(env, obj, "!=");
+    return builtin_cmp(env, obj, IDEARITH_NEQ);
+}
+
+int idearith_of(ibuiltin builtin) {
+    ibuiltin builtins[] = {
+        builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod,
+        builtin_pow, builtin_min, builtin_max,
+        builtin_gt, builtin_gte, builtin_lt, builtin_lte,
+        builtin_eq, builtin_neq
+    };
+
+    for (int op=0; op<=IDEARITH_NEQ; op++) {
+        if (builtins[op] == builtin) {
+            return op;
+        }
+    }
+    return IDEARITH_NONE;
+}
+
+// Applies op of an arithmetic or comparison builtin to count arguments on
+// the VM's stack, without building an s-expression of them. The caller
+// keeps the arguments, the first one is reused for the result when it
+// holds the only reference. Returns NULL for arguments only the builtin
+// itself handles.
+ideobj* idearith_call(int op, ideobj** args, int count) {
+    ideobj* reuse = args[0]->rc == 1 ? args[0] : NULL;
+
+    if (op <= IDEARITH_MAX) {
+        // Errors among the arguments are returned by ideobj_apply
+        for (int i=0; i<count; i++) {
+            if (!ideobj_is_numeric(args[i])) {
+                return NULL;
+            }
+        }
+        return idearith_apply(op, args, count, reuse);
+    }
+    if (count != 2) {
+        return NULL;
+    }
+
+    ideobj* left = args[0];
+    ideobj* right = args[1];
+    int both_num = left->type == IDEOBJ_NUM && right->type == IDEOBJ_NUM;
+
+    int status;
+    if (op >= IDEARITH_EQ) {
+        if (!both_num) {
+            return NULL;
+        }
+        status = (left->num == right->num) == (op == IDEARITH_EQ);
+    } else if (both_num) {
+        status = ideord_num(op, left->num, right->num);
+    } else if (ideobj_is_numeric(left) && ideobj_is_numeric(right)) {
+        status = ideord_decimal(
+            op, ideobj_decimal_value(left), ideobj_decimal_value(right)
+        );
+    } else {
+        return NULL;
+    }
+
+    if (!reuse) {
+        return ideobj_num(status);
+    }
+    reuse->type = IDEOBJ_NUM;
+    reuse->num = status;
+    return ideobj_copy(reuse);
 }
 
 ideobj* builtin_if(ideenv* env, ideobj* obj) {
@@ -1480,14 +3558,17 @@ ideobj* builtin_if(ideenv* env, ideobj* obj) {
     ideobj* consequence = ideobj_pop(obj, 0);
     ideobj* alternative = ideobj_pop(obj, 0);
 
-    consequence->type = IDEOBJ_SEXPR;
-    alternative->type = IDEOBJ_SEXPR;
-
     ideobj* result;
     if (ideobj_truthy(condition)) {
+        consequence = ideobj_cow(consequence);
+        consequence->type = IDEOBJ_SEXPR;
         result = ideobj_eval(env, consequence);
+        ideobj_del(alternative);
     } else {
+        alternative = ideobj_cow(alternative);
+        alternative->type = IDEOBJ_SEXPR;
         result = ideobj_eval(env, alternative);
+        ideobj_del(consequence);
     }
 
     ideobj_del(condition);
@@ -1496,12 +3577,36 @@ ideobj* builtin_if(ideenv* env, ideobj* obj) {
 }
 
 
-ideobj* builtin_and(ideenv* env, ideobj* obj) {
-    int status = 1;
+// Special forms are builtins that take their operands unevaluated when
+// called by name, and evaluate only the ones they need. Operands that
+// were evaluated already, as when the builtin is passed to map or
+// rebound, evaluate to themselves again. The VM compiles them to jumps
+// instead, see idevm_compile_form.
+enum {
+    IDEFORM_NONE = -1,
+    IDEFORM_AND,
+    IDEFORM_OR,
+    IDEFORM_COND,
+    IDEFORM_CASE
+};
 
-    for (int i=0; i<obj->count; i++) {
-        if (ideobj_truthy(obj->cell[i]) == 0) {
-            status = 0;
+char* ideform_names[] = { "and", "or", "cond", "case" };
+
+// Evaluates operands left to right until one is as truthy as stop
+ideobj* builtin_logic(ideenv* env, ideobj* obj, int stop) {
+    int status = !stop;
+
+    while (obj->count) {
+        ideobj* value = ideobj_eval(env, ideobj_pop(obj, 0));
+        if (value->type == IDEOBJ_ERR) {
+            ideobj_del(obj);
+            return value;
+        }
+
+        int truthy = ideobj_truthy(value);
+        ideobj_del(value);
+        if (truthy == stop) {
+            status = stop;
             break;
         }
     }
@@ -1510,18 +3615,124 @@ ideobj* builtin_and(ideenv* env, ideobj* obj) {
     return ideobj_num(status);
 }
 
+ideobj* builtin_and(ideenv* env, ideobj* obj) {
+    return builtin_logic(env, obj, 0);
+}
+
 ideobj* builtin_or(ideenv* env, ideobj* obj) {
-    int status = 0;
+    return builtin_logic(env, obj, 1);
+}
+
+ideobj* ideform_test_err(char* func, ideobj* test) {
+    return ideobj_err(
+        "Function '%s' test returned %s, Expected %s.",
+        func, idetype_name(test->type), idetype_name(IDEOBJ_NUM)
+    );
+}
+
+// Evaluates operand i of cond or case to its '(test value) clause
+ideobj* ideform_clause(ideenv* env, ideobj* obj, int i, char* func) {
+    ideobj* clause = ideobj_eval(env, ideobj_copy(obj->cell[i]));
+    if (clause->type == IDEOBJ_ERR) {
+        return clause;
+    }
+
+    if (clause->type != IDEOBJ_QEXPR || clause->count != 2) {
+        ideobj_del(clause);
+        return ideobj_err(
+            "Function '%s' passed invalid clause %i, Expected '(test value).",
+            func, i
+        );
+    }
+    return clause;
+}
+
+// Evaluates the value of the first clause whose test is true
+ideobj* builtin_cond(ideenv* env, ideobj* obj) {
+    IASSERT(obj, obj->count > 0, "No cases found");
 
     for (int i=0; i<obj->count; i++) {
-        if (ideobj_truthy(obj->cell[i]) == 1) {
-            status = 1;
+        ideobj* clause = ideform_clause(env, obj, i, "cond");
+        if (clause->type == IDEOBJ_ERR) {
+            ideobj_del(obj);
+            return clause;
+        }
+
+        ideobj* test = ideobj_eval(env, ideobj_copy(clause->cell[0]));
+        if (test->type != IDEOBJ_NUM || ideobj_truthy(test)) {
+            ideobj* result = test;
+            if (test->type == IDEOBJ_NUM) {
+                result = ideobj_eval(env, ideobj_copy(clause->cell[1]));
+                ideobj_del(test);
+            } else if (test->type != IDEOBJ_ERR) {
+                result = ideform_test_err("cond", test);
+                ideobj_del(test);
+            }
+
+            ideobj_del(clause);
+            ideobj_del(obj);
+            return result;
+        }
+
+        ideobj_del(test);
+        ideobj_del(clause);
+    }
+
+    ideobj_del(obj);
+    return ideobj_err("No matching case found");
+}
+
+// Evaluates the value of the first clause whose key equals the needle
+ideobj* builtin_case(ideenv* env, ideobj* obj) {
+    IASSERT(obj, obj->count > 1, "No case found");
+
+    ideobj* needle = ideobj_eval(env, ideobj_copy(obj->cell[0]));
+    if (needle->type == IDEOBJ_ERR) {
+        ideobj_del(obj);
+        return needle;
+    }
+
+    ideobj* result = NULL;
+    for (int i=1; i<obj->count && !result; i++) {
+        ideobj* clause = ideform_clause(env, obj, i, "case");
+        if (clause->type == IDEOBJ_ERR) {
+            result = clause;
             break;
         }
+
+        ideobj* key = ideobj_eval(env, ideobj_copy(clause->cell[0]));
+        if (key->type == IDEOBJ_ERR) {
+            result = ideobj_copy(key);
+        } else if (ideobj_eq(needle, key)) {
+            result = ideobj_eval(env, ideobj_copy(clause->cell[1]));
+        }
+
+        ideobj_del(key);
+        ideobj_del(clause);
     }
 
+    ideobj_del(needle);
     ideobj_del(obj);
-    return ideobj_num(status);
+    return result ? result : ideobj_err("No matching case found");
+}
+
+int ideform_of(ibuiltin builtin) {
+    ibuiltin builtins[] = { builtin_and, builtin_or, builtin_cond, builtin_case };
+
+    for (int form=0; form<=IDEFORM_CASE; form++) {
+        if (builtins[form] == builtin) {
+            return form;
+        }
+    }
+    return IDEFORM_NONE;
+}
+
+// Returns whether head, evaluated from the symbol name, is the special
+// form of that name
+int ideform_called(ideobj* head, char* name) {
+    return head->type == IDEOBJ_BUILTIN
+        && head->form != IDEFORM_NONE
+        && name == ideintern(ideform_names[head->form]);
 }
 
 ideobj* builtin_not(ideenv* env, ideobj* obj) {
@@ -1542,56 +3753,149 @@ ideobj* builtin_keyword(ideenv* env, ideobj* obj) {
     return keyword;
 }
 
-ideobj* ideobj_read(mpc_ast_t* node);
+ideobj* ideload(ideenv* env, char* path, FILE* file);
 
-ideobj* builtin_load(ideenv* env, ideobj *obj) {
-    IASSERT_NUM("load", obj, 1);
-    IASSERT_TYPE("load", obj, 0, IDEOBJ_STR);
+// A list of owned path strings
+typedef struct idepath_list {
+    char** paths;
+    int count;
+    int capacity;
+} idepath_list;
 
-    mpc_result_t result;
-    if (mpc_parse_contents(obj->cell[0]->str, IdeLISP, &result)) {
-        ideobj* expressions = ideobj_read(result.output);
-        mpc_ast_delete(result.output);
+// Canonical paths of the modules loaded so far, load skips these
+idepath_list idemodules;
 
-        while (expressions->count) {
-            ideobj* expression = ideobj_eval(env, ideobj_pop(expressions, 0));
-            if (expression->type == IDEOBJ_ERR) {
-              return expression;
-            }
-            ideobj_del(expression);
+// Directories searched in order for relative paths load can't open from
+// the working directory, added with --path
+idepath_list idemodule_dirs;
+
+int idepath_find(idepath_list* list, char* path) {
+    for (int i=0; i<list->count; i++) {
+        if (strcmp(list->paths[i], path) == 0) {
+            return i;
         }
+    }
+    return -1;
+}
+
+void idepath_add(idepath_list* list, char* path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->paths = realloc(list->paths, sizeof(char*) * list->capacity);
+    }
+    list->paths[list->count] = malloc(strlen(path) + 1);
+    strcpy(list->paths[list->count++], path);
+}
+
+void idepath_remove(idepath_list* list, char* path) {
+    int i = idepath_find(list, path);
+    if (i < 0) {
+        return;
+    }
+    free(list->paths[i]);
+    list->paths[i] = list->paths[--list->count];
+}
+
+// Opens path, or the first file named path under a --path directory when
+// it is relative. Sets found to the path that opened, free it after use.
+FILE* idemodule_open(char* path, char** found) {
+    *found = malloc(strlen(path) + 1);
+    strcpy(*found, path);
+    FILE* file = fopen(path, "rb");
+    for (int i=0; !file && path[0] != '/' && i<idemodule_dirs.count; i++) {
+        char* dir = idemodule_dirs.paths[i];
+        *found = realloc(*found, strlen(dir) + strlen(path) + 2);
+        sprintf(*found, "%s/%s", dir, path);
+        file = fopen(*found, "rb");
+    }
+    return file;
+}
+
+// Loads the module at the path in obj, unless it was loaded before and
+// force is 0. The path "-" loads stdin and is never remembered.
+ideobj* idemodule_load(ideenv* env, ideobj* obj, char* name, int force) {
+    IASSERT_NUM(name, obj, 1);
+    IASSERT_TYPE(name, obj, 0, IDEOBJ_STR);
 
-        ideobj_del(expressions);
+    char* path = obj->cell[0]->str;
+    if (strcmp(path, "-") == 0) {
         ideobj_del(obj);
-        return ideobj_sexpr();
-    } else {
-        char* result_err = mpc_err_string(result.error);
+        return ideload(env, "-", stdin);
+    }
 
+    char* found;
+    FILE* file = idemodule_open(path, &found);
+    if (!file) {
         ideobj* err = ideobj_err(
-            "Could not load module %s, reason %s",
-            obj->cell[0]->str,
-            result_err
+            "Could not load module %s, reason %s:1:1: error: Unable to open file!",
+            path,
+            path
         );
-
-        mpc_err_delete(result.error);
-        free(result_err);
+        free(found);
         ideobj_del(obj);
-
         return err;
     }
-}
 
-ideobj* ideobj_call_builtin(ideenv* env, ideobj* fun, ideobj* args) {
-    return fun->builtin(env, args);
+    // Symlinks and spellings like ./a.ilisp and a.ilisp name one module
+    char* canonical = realpath(found, NULL);
+    if (!canonical) {
+        canonical = found;
+        found = NULL;
+    }
+
+    ideobj* result;
+    int loaded = idepath_find(&idemodules, canonical) >= 0;
+    if (loaded && !force) {
+        result = ideobj_sexpr();
+    } else {
+        // Registered before evaluating, so modules that load each other
+        // stop, and forgotten again if it fails so a later load retries
+        if (!loaded) {
+            idepath_add(&idemodules, canonical);
+        }
+        result = ideload(env, found ? found : canonical, file);
+        if (result->type == IDEOBJ_ERR) {
+            idepath_remove(&idemodules, canonical);
+        }
+    }
+
+    fclose(file);
+    free(canonical);
+    free(found);
+    ideobj_del(obj);
+    return result;
 }
 
-ideobj* ideobj_call_fun(ideenv* env, ideobj* fun, ideobj* args) {
+// Reads and evaluates one top-level expression at a time, see ideload.
+// Loading a module that was already loaded does nothing.
+ideobj* builtin_load(ideenv* env, ideobj *obj) {
+    return idemodule_load(env, obj, "load", 0);
+}
+
+// Loads a module again even if it was already loaded
+ideobj* builtin_reload(ideenv* env, ideobj* obj) {
+    return idemodule_load(env, obj, "reload", 1);
+}
+
+ideobj* ideobj_call_builtin(ideenv* env, ideobj* fun, ideobj* args) {
+    ideobj* result = fun->builtin(env, args);
+    ideobj_del(fun);
+    return result;
+}
+
+// Binds args to the parameters of fun in a new call frame and returns it,
+// fun is kept. Otherwise returns NULL, with *result set to an error or
+// to the partially applied function, and fun released.
+ideenv* ideobj_bind(ideenv* env, ideobj* fun, ideobj* args, ideobj** result) {
     int fun_num_params = fun->params->count;
     int num_args = args->count;
     int has_zero_arity = 0;
+    int bound = 0;
 
-    ideenv* fn_env = ideenv_copy(env);
-    fn_env->parent = fun->env;
+    ideenv* fn_env = ideenv_new();
+    fn_env->parent = ideenv_retain(fun->env);
+    fn_env->caller = ideenv_retain(env);
+    fn_env->depth = env->depth;
 
     // Allow calling zero arity functions with empty sexpr arg
     if (fun->params->count == 0) {
@@ -1608,82 +3912,189 @@ ideobj* ideobj_call_fun(ideenv* env, ideobj* fun, ideobj* args) {
     }
 
     while (args->count && !has_zero_arity) {
-        if (fun->params->count == 0) {
+        if (bound == fun_num_params) {
             ideobj_del(args);
+            ideobj_del(fun);
+            ideenv_del(fn_env);
 
-            return ideobj_err(
+            *result = ideobj_err(
                 "Function received too many arguments, expected %i, got %i",
                 fun_num_params,
                 num_args
             );
+            return NULL;
         }
 
-        ideobj *param = ideobj_pop(fun->params, 0);
+        ideobj *param = fun->params->cell[bound++];
 
         if (strcmp(param->symbol, "&rest") == 0) {
-            if (fun->params->count != 1) {
+            if (fun_num_params - bound != 1) {
                 ideobj_del(args);
-                return ideobj_err(
+                ideobj_del(fun);
+                ideenv_del(fn_env);
+                *result = ideobj_err(
                     "Invalid function format, &rest must be followed by symbol"
                 );
+                return NULL;
             }
 
-
-            ideobj *rest_param = ideobj_pop(fun->params, 0);
-            ideenv_put(fn_env, rest_param, builtin_list(fn_env, args));
-            ideobj_del(param);
-            ideobj_del(rest_param);
+            ideobj *rest_param = fun->params->cell[bound++];
+            args = builtin_list(fn_env, args);
+            ideenv_put(fn_env, rest_param, args);
             break;
         }
 
         ideobj *value = ideobj_pop(args, 0);
 
         ideenv_put(fn_env, param, value);
-        ideobj_del(param);
         ideobj_del(value);
     }
 
     ideobj_del(args);
 
-    if (fun->params->count == 0) {
-        return builtin_eval(
-            fn_env,
-            ideobj_list_add(
-                ideobj_sexpr(),
-                ideobj_copy(fun->body)
-            )
-        );
-    } else {
-        fun->env = fn_env;
-        return ideobj_copy(fun);
+    if (bound == fun_num_params) {
+        return fn_env;
+    }
+
+    // Partially applied, the bound arguments live on in fn_env
+    ideobj* params = ideobj_qexpr();
+    for (int i=bound; i<fun_num_params; i++) {
+        ideobj_list_add(params, ideobj_copy(fun->params->cell[i]));
+    }
+
+    ideobj* partial = ideobj_new(IDEOBJ_FUN);
+    partial->env = fn_env;
+    partial->params = params;
+    partial->body = ideobj_copy(fun->body);
+
+    ideobj_del(fun);
+    *result = partial;
+    return NULL;
+}
+
+int idevm_enabled = 1;
+ideobj* idevm_run(ideobj* fun, ideenv* env);
+
+// Limits on how deep evaluation goes before it fails with an error. Calls
+// on the machine keep their frames on the heap and are capped by count.
+// Evaluations nesting on the C stack, through builtins that evaluate or
+// in the tree walker, are capped by the bytes of stack they use, which
+// an embedder running interpreters on small thread stacks lowers to fit.
+long idedepth_max_frames = 1L << 20;
+long idedepth_max_stack = 4L << 20;
+char* idedepth_stack_base;
+
+int idedepth_stack_exceeded(void) {
+    char here;
+    return idedepth_stack_base
+        && labs((long) (idedepth_stack_base - &here)) > idedepth_max_stack;
+}
+
+ideobj* ideobj_call_fun(ideenv* env, ideobj* fun, ideobj* args) {
+    ideobj* result;
+    ideenv* fn_env = ideobj_bind(env, fun, args, &result);
+    if (!fn_env) {
+        return result;
+    }
+
+    if (idevm_enabled) {
+        return idevm_run(fun, fn_env);
     }
+
+    idegc_push(fn_env);
+    idegc_safepoint();
+    result = builtin_eval(
+        fn_env,
+        ideobj_list_add(
+            ideobj_sexpr(),
+            ideobj_copy(fun->body)
+        )
+    );
+    idegc_pop();
+
+    ideenv_del(fn_env);
+    ideobj_del(fun);
+    return result;
 }
 
 
+int ideobj_self_evaluating(ideobj* obj) {
+    return obj->type != IDEOBJ_SYMBOL
+        && obj->type != IDEOBJ_SEXPR
+        && obj->type != IDEOBJ_HASHMAP;
+}
+
 ideobj* ideobj_eval_hashmap(ideenv* env, ideobj* obj) {
-    for (int i=0; i<obj->count; i++) {
-        obj->keys[i] = ideobj_eval(env, obj->keys[i]);
-        obj->cell[i] = ideobj_eval(env, obj->cell[i]);
+    ideslot** entries = idemap_ordered(obj);
+
+    // Maps of constants evaluate to themselves
+    int constant = 1;
+    for (int i=0; i<obj->size && constant; i++) {
+        constant = ideobj_self_evaluating(entries[i]->key)
+            && ideobj_self_evaluating(entries[i]->val);
     }
 
-    for (int i=0; i<obj->count; i++) {
-        if (obj->keys[i]->type == IDEOBJ_ERR) {
-            return ideobj_hashmap_take(obj, i, "key");
+    if (constant) {
+        free(entries);
+        return obj;
+    }
+
+    ideobj* hm = ideobj_hashmap();
+    ideobj* err = NULL;
+
+    for (int i=0; i<obj->size; i++) {
+        ideobj* key = ideobj_eval(env, ideobj_copy(entries[i]->key));
+        if (key->type == IDEOBJ_ERR) {
+            err = key;
+            break;
         }
 
-        if (obj->cell[i]->type == IDEOBJ_ERR) {
-            return ideobj_hashmap_take(obj, i, "value");
+        ideobj* val = ideobj_eval(env, ideobj_copy(entries[i]->val));
+        if (val->type == IDEOBJ_ERR) {
+            ideobj_del(key);
+            err = val;
+            break;
         }
+
+        ideobj_hashmap_add(hm, key, val);
     }
 
-    return obj;
+    free(entries);
+    ideobj_del(obj);
+
+    if (err) {
+        ideobj_del(hm);
+        return err;
+    }
+    return hm;
 }
 
+ideobj* ideobj_apply(ideenv* env, ideobj* obj, ideenv** frame);
+
 ideobj* ideobj_eval_sexpr(ideenv* env, ideobj* obj) {
-    for (int i=0; i<obj->count; i++) {
+    obj = ideobj_cow(obj);
+
+    int first = 0;
+    if (obj->count > 1 && obj->cell[0]->type == IDEOBJ_SYMBOL) {
+        char* name = obj->cell[0]->symbol;
+        obj->cell[0] = ideobj_eval(env, obj->cell[0]);
+        if (ideform_called(obj->cell[0], name)) {
+            return ideobj_call_builtin(env, ideobj_pop(obj, 0), obj);
+        }
+        first = 1;
+    }
+
+    for (int i=first; i<obj->count; i++) {
         obj->cell[i] = ideobj_eval(env, obj->cell[i]);
     }
 
+    return ideobj_apply(env, obj, NULL);
+}
+
+// Applies an s-expression whose cells are evaluated. When frame is given,
+// a function call is only bound: its env is returned in *frame and the
+// function itself as the result, for the caller to run the body.
+ideobj* ideobj_apply(ideenv* env, ideobj* obj, ideenv** frame) {
     for (int i=0; i<obj->count; i++) {
         if (obj->cell[i]->type == IDEOBJ_ERR) {
             return ideobj_take(obj, i);
@@ -1725,20 +4136,37 @@ ideobj* ideobj_eval_sexpr(ideenv* env, ideobj* obj) {
 
     if (first->type == IDEOBJ_BUILTIN) {
         return ideobj_call_builtin(env, first, obj);
-    } else {
-        return ideobj_call_fun(env, first, obj);
     }
+
+    if (frame) {
+        ideobj* result;
+        *frame = ideobj_bind(env, first, obj, &result);
+        return *frame ? first : result;
+    }
+    return ideobj_call_fun(env, first, obj);
 }
 
 ideobj* ideobj_eval(ideenv* env, ideobj* obj) {
     if (obj->type == IDEOBJ_SYMBOL) {
-        ideobj* value = ideenv_get(env, obj);
+        ideobj* value = ideenv_lookup(env, obj);
         ideobj_del(obj);
         return value;
     }
 
     if (obj->type == IDEOBJ_SEXPR) {
-        return ideobj_eval_sexpr(env, obj);
+        // Top-level evaluations mark where the stack starts
+        char top;
+        if (gc.depth == 0) {
+            idedepth_stack_base = &top;
+        } else if (idedepth_stack_exceeded()) {
+            ideobj_del(obj);
+            return ideobj_err("Expression nested too deeply");
+        }
+
+        gc.depth++;
+        ideobj* result = ideobj_eval_sexpr(env, obj);
+        gc.depth--;
+        return result;
     }
 
     if (obj->type == IDEOBJ_HASHMAP) {
@@ -1747,85 +4175,2844 @@ ideobj* ideobj_eval(ideenv* env, ideobj* obj) {
     return obj;
 }
 
-ideobj* ideobj_read_decimal(mpc_ast_t* node) {
-    errno = 0;
-    double decimal = strtod(node->contents, NULL);
-    if (errno == ERANGE) {
-        return ideobj_err("Invalid number");
+// Evaluates a list element on its own, as fst and nth do
+ideobj* ideobj_unwrap(ideenv* env, ideobj* elem) {
+    if (ideobj_self_evaluating(elem)) {
+        return ideobj_copy(elem);
     }
-    return ideobj_decimal(decimal);
+
+    ideobj* expr = ideobj_sexpr();
+    ideobj_list_add(expr, ideobj_copy(elem));
+    return ideobj_eval(env, expr);
 }
 
-ideobj* ideobj_read_num(mpc_ast_t* node) {
-    errno = 0;
-    long num = strtol(node->contents, NULL, 10);
-    if (errno == ERANGE) {
-        return ideobj_err("Invalid number");
+// Applies f to count arguments as (f ...) would, taking the arguments
+ideobj* ideobj_call(ideenv* env, ideobj* f, ideobj** args, int count) {
+    if (f->type == IDEOBJ_BUILTIN && f->arith != IDEARITH_NONE && count) {
+        ideobj* result = idearith_call(f->arith, args, count);
+        if (result) {
+            for (int i=0; i<count; i++) {
+                ideobj_del(args[i]);
+            }
+            return result;
+        }
     }
-    return ideobj_num(num);
+
+    ideobj* expr = ideobj_sexpr();
+    idelist_reserve(expr, count + 1);
+    expr->cell[0] = ideobj_copy(f);
+    memcpy(&expr->cell[1], args, sizeof(ideobj*) * count);
+    expr->count = count + 1;
+    return ideobj_apply(env, expr, NULL);
 }
 
-ideobj* ideobj_read_string(mpc_ast_t* node) {
-    node->contents[strlen(node->contents)-1] = '\0';
+// Applies predicate p to value, which is kept. Sets *keep and returns
+// NULL, or returns the error
+ideobj* ideobj_test(
+    ideenv* env, ideobj* p, ideobj* value, char* func, int* keep
+) {
+    ideobj* arg = ideobj_copy(value);
+    ideobj* result = ideobj_call(env, p, &arg, 1);
+    if (result->type == IDEOBJ_ERR) {
+        return result;
+    }
 
-    char* unescaped = malloc(strlen(node->contents+1)+1);
-    strcpy(unescaped, node->contents+1);
+    if (result->type != IDEOBJ_NUM) {
+        ideobj* err = ideobj_err(
+            "Function '%s' predicate returned %s, Expected %s.",
+            func, idetype_name(result->type), idetype_name(IDEOBJ_NUM)
+        );
+        ideobj_del(result);
+        return err;
+    }
 
-    unescaped = mpcf_unescape(unescaped);
-    ideobj* obj = ideobj_str(unescaped);
-    free(unescaped);
-    return obj;
+    *keep = ideobj_truthy(result);
+    ideobj_del(result);
+    return NULL;
 }
 
-ideobj* ideobj_read_keyword(mpc_ast_t* node) {
-    char* keyword = malloc(strlen(node->contents));
-    strcpy(keyword, node->contents+1);
+// Reads a sequence with one cursor per stage, mirroring its chain. The
+// cursor does not own the sequence, its driver keeps it alive.
+typedef struct idecursor {
+    ideseq* seq;
+    long next;
+    int done;
+    struct idecursor* source;
+} idecursor;
+
+idecursor* idecursor_new(ideobj* obj) {
+    idecursor* cursor = malloc(sizeof(idecursor));
+    cursor->seq = obj->seq;
+    cursor->next = obj->seq->stage == IDESEQ_RANGE ? obj->seq->from : 0;
+    cursor->done = 0;
+    cursor->source = obj->seq->source
+        ? idecursor_new(obj->seq->source)
+        : NULL;
+    return cursor;
+}
 
-    ideobj* obj = ideobj_keyword(keyword);
-    return obj;
+void idecursor_del(idecursor* cursor) {
+    while (cursor) {
+        idecursor* source = cursor->source;
+        free(cursor);
+        cursor = source;
+    }
 }
 
-ideobj* ideobj_read(mpc_ast_t* node) {
-    if (strstr(node->tag, "decimal")) { return ideobj_read_decimal(node); }
-    if (strstr(node->tag, "number")) { return ideobj_read_num(node); }
-    if (strstr(node->tag, "string")) { return ideobj_read_string(node); }
-    if (strstr(node->tag, "keyword")) { return ideobj_read_keyword(node); }
-    if (strstr(node->tag, "symbol")) {
-        return ideobj_symbol(node->contents);
-    }
-
-    ideobj* acc_value = NULL;
-    if (strcmp(node->tag, ">") == 0) { acc_value = ideobj_sexpr(); }
-    if (strstr(node->tag, "sexpr")) { acc_value = ideobj_sexpr(); }
-    if (strstr(node->tag, "qexpr")) { acc_value = ideobj_qexpr(); }
-    if (strstr(node->tag, "hashmap")) { acc_value = ideobj_hashmap(); }
-
-    for (int i=0; i<node->children_num; i++) {
-        if (strstr(node->children[i]->tag, "comment")) { continue; }
-        if (strcmp(node->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(node->children[i]->contents, "'(") == 0) { continue; }
-        if (strcmp(node->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(node->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(node->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(node->children[i]->tag, "regex") == 0) { continue; }
-
-        if (acc_value->type == IDEOBJ_HASHMAP) {
-            acc_value = ideobj_hashmap_add(
-                acc_value,
-                ideobj_read(node->children[i]),
-                ideobj_read(node->children[i+1])
-            );
-            i++;
-        } else {
-            acc_value = ideobj_list_add(acc_value, ideobj_read(node->children[i]));
+// Skips count elements of a range cursor. Distances are unsigned, since
+// they can be larger than any long.
+void idecursor_skip_range(idecursor* cursor, long count) {
+    ideseq* seq = cursor->seq;
+    int up = seq->step > 0;
+    if (cursor->done || (up ? cursor->next >= seq->to : cursor->next <= seq->to)) {
+        cursor->done = 1;
+        return;
+    }
+
+    unsigned long distance = up
+        ? (unsigned long) seq->to - (unsigned long) cursor->next
+        : (unsigned long) cursor->next - (unsigned long) seq->to;
+    unsigned long step = up
+        ? (unsigned long) seq->step
+        : 0UL - (unsigned long) seq->step;
+    unsigned long left = (distance - 1) / step + 1;
+
+    if ((unsigned long) count >= left) {
+        cursor->done = 1;
+        return;
+    }
+
+    // Short of the end, so this lands between next and to
+    cursor->next = (long) (
+        (unsigned long) cursor->next + (unsigned long) count * (unsigned long) seq->step
+    );
+}
+
+// Returns the next element, an error, or NULL once the sequence is done.
+// Only the elements asked for are computed, one at a time.
+ideobj* idecursor_next(ideenv* env, idecursor* cursor) {
+    ideseq* seq = cursor->seq;
+    if (cursor->done) {
+        return NULL;
+    }
+
+    switch (seq->stage) {
+        case IDESEQ_RANGE: {
+            int more = seq->step > 0
+                ? cursor->next < seq->to
+                : cursor->next > seq->to;
+            if (!more) {
+                cursor->done = 1;
+                return NULL;
+            }
+            long value = cursor->next;
+
+            // A step past the largest or smallest number ends the range
+            // instead of wrapping around
+            if (
+                seq->step > 0
+                    ? value > LONG_MAX - seq->step
+                    : value < LONG_MIN - seq->step
+            ) {
+                cursor->done = 1;
+            } else {
+                cursor->next += seq->step;
+            }
+            return ideobj_num(value);
+        }
+        case IDESEQ_MAP: {
+            ideobj* value = idecursor_next(env, cursor->source);
+            if (!value || value->type == IDEOBJ_ERR) {
+                return value;
+            }
+            return ideobj_call(env, seq->fn, &value, 1);
         }
+        case IDESEQ_FILTER:
+        case IDESEQ_TAKE_WHILE: {
+            char* func = seq->stage == IDESEQ_FILTER ? "filter" : "take-while";
+            while (1) {
+                ideobj* value = idecursor_next(env, cursor->source);
+                if (!value || value->type == IDEOBJ_ERR) {
+                    return value;
+                }
+
+                int keep;
+                ideobj* err = ideobj_test(env, seq->fn, value, func, &keep);
+                if (err || keep) {
+                    if (err) {
+                        ideobj_del(value);
+                    }
+                    return err ? err : value;
+                }
+
+                ideobj_del(value);
+                if (seq->stage == IDESEQ_TAKE_WHILE) {
+                    cursor->done = 1;
+                    return NULL;
+                }
+            }
+        }
+        case IDESEQ_TAKE:
+            if (cursor->next == seq->to) {
+                cursor->done = 1;
+                return NULL;
+            }
+            cursor->next++;
+            return idecursor_next(env, cursor->source);
+        case IDESEQ_DROP:
+            // Ranges are skipped by arithmetic, not an element at a time
+            if (
+                cursor->next < seq->to &&
+                cursor->source->seq->stage == IDESEQ_RANGE
+            ) {
+                idecursor_skip_range(cursor->source, seq->to - cursor->next);
+                cursor->next = seq->to;
+            }
+            while (cursor->next < seq->to) {
+                cursor->next++;
+                ideobj* value = idecursor_next(env, cursor->source);
+                if (!value || value->type == IDEOBJ_ERR) {
+                    return value;
+                }
+                ideobj_del(value);
+            }
+            return idecursor_next(env, cursor->source);
+    }
+
+    return NULL;
+}
+
+// Collects the elements of a sequence into a list, taking obj. Anything
+// else is returned as it is.
+ideobj* ideobj_realize(ideenv* env, ideobj* obj) {
+    if (obj->type != IDEOBJ_SEQ) {
+        return obj;
+    }
 
+    ideobj* result = ideobj_qexpr();
+    idecursor* cursor = idecursor_new(obj);
+    ideobj* value;
+    while ((value = idecursor_next(env, cursor))) {
+        if (value->type == IDEOBJ_ERR) {
+            ideobj_del(result);
+            result = value;
+            break;
+        }
+        ideobj_list_add(result, value);
     }
 
-    return acc_value;
+    idecursor_del(cursor);
+    ideobj_del(obj);
+    return result;
 }
 
-void ideenv_add_builtin(ideenv* env, char* name, ibuiltin fn) {
+// Counts the elements of a sequence without keeping them
+ideobj* ideseq_len(ideenv* env, ideobj* obj) {
+    idecursor* cursor = idecursor_new(obj);
+    long count = 0;
+    ideobj* value;
+    while ((value = idecursor_next(env, cursor))) {
+        if (value->type == IDEOBJ_ERR) {
+            idecursor_del(cursor);
+            return value;
+        }
+        ideobj_del(value);
+        count++;
+    }
+
+    idecursor_del(cursor);
+    return ideobj_num(count);
+}
+
+// Returns a new stage reading from the sequence in the last argument,
+// taking args. The first argument is the stage's function or count.
+ideobj* ideseq_stage(ideobj* args, int stage) {
+    ideobj* first = ideobj_pop(args, 0);
+    ideobj* source = ideobj_take(args, 0);
+
+    if (first->type != IDEOBJ_NUM) {
+        return ideobj_seq(stage, first, source);
+    }
+
+    ideobj* seq = ideobj_seq(stage, NULL, source);
+    seq->seq->to = first->num;
+    ideobj_del(first);
+    return seq;
+}
+
+ideobj* builtin_range(ideenv* env, ideobj* obj) {
+    IASSERT(
+        obj,
+        obj->count >= 1 && obj->count <= 3,
+        "Function 'range' passed incorrect number of arguments. "
+        "Got %i, Expected 1 to 3.",
+        obj->count
+    );
+    for (int i=0; i<obj->count; i++) {
+        IASSERT_TYPE("range", obj, i, IDEOBJ_NUM);
+    }
+
+    ideobj* seq = ideobj_seq(IDESEQ_RANGE, NULL, NULL);
+    if (obj->count == 1) {
+        seq->seq->to = obj->cell[0]->num;
+    } else {
+        seq->seq->from = obj->cell[0]->num;
+        seq->seq->to = obj->cell[1]->num;
+    }
+    if (obj->count == 3) {
+        seq->seq->step = obj->cell[2]->num;
+    }
+
+    if (seq->seq->step == 0) {
+        ideobj_del(seq);
+        ideobj_del(obj);
+        return ideobj_err("Function 'range' passed a step of 0.");
+    }
+
+    ideobj_del(obj);
+    return seq;
+}
+
+// The list functions below used to be defined in standard.ilisp. They
+// take the same arguments and unwrap elements the same way, but run in
+// one pass over the list. Given a sequence instead, map, filter,
+// take-while, take and drop return a new lazy stage over it, and foldl,
+// sum and product read it an element at a time.
+
+// Passed fewer arguments than it has params, a list function is
+// partially applied, as when it was defined in standard.ilisp. It is
+// wrapped in a function with those params calling the builtin, and
+// bound like any other function, see ideobj_bind. params ends in NULL.
+ideobj* idebuiltin_curry(
+    ideenv* env, ideobj* args, ibuiltin builtin, char** params
+) {
+    ideobj* names = ideobj_qexpr();
+    ideobj* body = ideobj_qexpr();
+    ideobj_list_add(body, ideobj_builtin(builtin));
+    for (int i=0; params[i]; i++) {
+        ideobj_list_add(names, ideobj_symbol(params[i]));
+        ideobj_list_add(body, ideobj_symbol(params[i]));
+    }
+
+    ideenv* global = ideenv_global(env);
+    idescope scope = { names, 0, NULL };
+    ideobj_resolve(body, &scope, global);
+
+    ideobj* fun = ideobj_fun(names, body);
+    fun->env->parent = ideenv_retain(global);
+    fun->env->depth = global->depth + 1;
+
+    ideobj* result;
+    ideobj_bind(env, fun, args, &result);
+    return result;
+}
+
+#define ICURRY(env, args, builtin, ...) \
+  do { \
+    char* params[] = { __VA_ARGS__, NULL }; \
+    int count = sizeof(params) / sizeof(char*) - 1; \
+    if (args->count < count) { \
+      return idebuiltin_curry(env, args, builtin, params); \
+    } \
+  } while (0)
+
+ideobj* builtin_map(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_map, "f", "items");
+    IASSERT_NUM("map", obj, 2);
+    if (obj->cell[1]->type == IDEOBJ_SEQ) {
+        return ideseq_stage(obj, IDESEQ_MAP);
+    }
+    IASSERT_TYPE("map", obj, 1, IDEOBJ_QEXPR);
+
+    ideobj* f = obj->cell[0];
+    ideobj* items = obj->cell[1];
+    ideobj* result = ideobj_qexpr();
+    idelist_reserve(result, items->count);
+
+    for (int i=0; i<items->count; i++) {
+        ideobj* arg = ideobj_unwrap(env, items->cell[i]);
+        ideobj* value = ideobj_call(env, f, &arg, 1);
+        if (value->type == IDEOBJ_ERR) {
+            ideobj_del(result);
+            ideobj_del(obj);
+            return value;
+        }
+        ideobj_list_add(result, value);
+    }
+
+    ideobj_del(obj);
+    return result;
+}
+
+// Keeps the elements matching a predicate, for filter, or the ones
+// before the first that does not, for take-while
+ideobj* builtin_select(ideenv* env, ideobj* obj, char* func, int stage) {
+    IASSERT_NUM(func, obj, 2);
+    if (obj->cell[1]->type == IDEOBJ_SEQ) {
+        return ideseq_stage(obj, stage);
+    }
+    IASSERT_TYPE(func, obj, 1, IDEOBJ_QEXPR);
+
+    ideobj* p = obj->cell[0];
+    ideobj* items = obj->cell[1];
+    ideobj* result = ideobj_qexpr();
+
+    for (int i=0; i<items->count; i++) {
+        ideobj* value = ideobj_unwrap(env, items->cell[i]);
+        int keep;
+        ideobj* err = ideobj_test(env, p, value, func, &keep);
+        ideobj_del(value);
+        if (err) {
+            ideobj_del(result);
+            ideobj_del(obj);
+            return err;
+        }
+
+        if (!keep && stage == IDESEQ_TAKE_WHILE) {
+            break;
+        }
+
+        // The element itself is kept, not its unwrapped value
+        if (keep) {
+            ideobj_list_add(result, ideobj_copy(items->cell[i]));
+        }
+    }
+
+    ideobj_del(obj);
+    return result;
+}
+
+ideobj* builtin_filter(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_filter, "p", "items");
+    return builtin_select(env, obj, "filter", IDESEQ_FILTER);
+}
+
+ideobj* builtin_take_while(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_take_while, "p", "items");
+    return builtin_select(env, obj, "take-while", IDESEQ_TAKE_WHILE);
+}
+
+ideobj* builtin_foldl(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_foldl, "f", "acc", "items");
+    IASSERT_NUM("foldl", obj, 3);
+    if (obj->cell[2]->type != IDEOBJ_SEQ) {
+        IASSERT_TYPE("foldl", obj, 2, IDEOBJ_QEXPR);
+    }
+
+    ideobj* f = obj->cell[0];
+    ideobj* items = obj->cell[2];
+    ideobj* acc = ideobj_copy(obj->cell[1]);
+
+    if (items->type == IDEOBJ_SEQ) {
+        idecursor* cursor = idecursor_new(items);
+        while (acc->type != IDEOBJ_ERR) {
+            ideobj* value = idecursor_next(env, cursor);
+            if (!value) {
+                break;
+            }
+            ideobj* args[2] = { acc, value };
+            acc = ideobj_call(env, f, args, 2);
+        }
+        idecursor_del(cursor);
+    } else {
+        for (int i=0; i<items->count; i++) {
+            ideobj* args[2] = { acc, ideobj_unwrap(env, items->cell[i]) };
+            acc = ideobj_call(env, f, args, 2);
+            if (acc->type == IDEOBJ_ERR) {
+                break;
+            }
+        }
+    }
+
+    ideobj_del(obj);
+
+    // The result is evaluated once more, as returning '(acc) did
+    return ideobj_eval(env, acc);
+}
+
+ideobj* builtin_last(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("last", obj, 1);
+    IASSERT_TYPE("last", obj, 0, IDEOBJ_QEXPR);
+    IASSERT_NOT_EMPTY("last", obj, 0);
+
+    ideobj* items = obj->cell[0];
+    ideobj* value = ideobj_unwrap(env, items->cell[items->count - 1]);
+    ideobj_del(obj);
+    return value;
+}
+
+ideobj* builtin_take(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_take, "num", "items");
+    IASSERT_NUM("take", obj, 2);
+    IASSERT_TYPE("take", obj, 0, IDEOBJ_NUM);
+    if (obj->cell[1]->type == IDEOBJ_SEQ) {
+        IASSERT(
+            obj,
+            obj->cell[0]->num >= 0,
+            "Function 'take' passed %li, Expected a count of 0 or more.",
+            obj->cell[0]->num
+        );
+        return ideseq_stage(obj, IDESEQ_TAKE);
+    }
+    IASSERT_TYPE("take", obj, 1, IDEOBJ_QEXPR);
+    IASSERT(
+        obj,
+        obj->cell[0]->num >= 0 && obj->cell[0]->num <= obj->cell[1]->count,
+        "Function 'take' passed %li, out of range for length %i.",
+        obj->cell[0]->num, obj->cell[1]->count
+    );
+
+    int num = obj->cell[0]->num;
+    ideobj* list = ideobj_take(obj, 1);
+    if (num == list->count) {
+        return list;
+    }
+
+    if (list->rc > 1) {
+        return idelist_view(list, 0, num);
+    }
+    ideobj_truncate(list, num);
+    return list;
+}
+
+ideobj* builtin_drop(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_drop, "num", "items");
+    IASSERT_NUM("drop", obj, 2);
+    IASSERT_TYPE("drop", obj, 0, IDEOBJ_NUM);
+    if (obj->cell[1]->type == IDEOBJ_SEQ) {
+        IASSERT(
+            obj,
+            obj->cell[0]->num >= 0,
+            "Function 'drop' passed %li, Expected a count of 0 or more.",
+            obj->cell[0]->num
+        );
+        return ideseq_stage(obj, IDESEQ_DROP);
+    }
+    IASSERT_TYPE("drop", obj, 1, IDEOBJ_QEXPR);
+    IASSERT(
+        obj,
+        obj->cell[0]->num >= 0 && obj->cell[0]->num <= obj->cell[1]->count,
+        "Function 'drop' passed %li, out of range for length %i.",
+        obj->cell[0]->num, obj->cell[1]->count
+    );
+
+    int num = obj->cell[0]->num;
+    ideobj* list = ideobj_take(obj, 1);
+    if (num == 0) {
+        return list;
+    }
+
+    if (list->rc > 1) {
+        return idelist_view(list, num, list->count - num);
+    }
+    for (int i=0; i<num; i++) {
+        ideobj_del(ideobj_pop(list, 0));
+    }
+    return list;
+}
+
+ideobj* builtin_zip(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_zip, "x", "y");
+    IASSERT_NUM("zip", obj, 2);
+    IASSERT_TYPE("zip", obj, 0, IDEOBJ_QEXPR);
+    IASSERT_TYPE("zip", obj, 1, IDEOBJ_QEXPR);
+
+    ideobj* x = obj->cell[0];
+    ideobj* y = obj->cell[1];
+    int count = x->count < y->count ? x->count : y->count;
+
+    ideobj* result = ideobj_qexpr();
+    idelist_reserve(result, count);
+    for (int i=0; i<count; i++) {
+        ideobj* pair = ideobj_qexpr();
+        ideobj_list_add(pair, ideobj_copy(x->cell[i]));
+        ideobj_list_add(pair, ideobj_copy(y->cell[i]));
+        ideobj_list_add(result, pair);
+    }
+
+    ideobj_del(obj);
+    return result;
+}
+
+ideobj* builtin_elem(ideenv* env, ideobj* obj) {
+    ICURRY(env, obj, builtin_elem, "needle", "items");
+    IASSERT_NUM("elem", obj, 2);
+    IASSERT_TYPE("elem", obj, 1, IDEOBJ_QEXPR);
+
+    ideobj* needle = obj->cell[0];
+    ideobj* items = obj->cell[1];
+    int found = 0;
+
+    for (int i=0; i<items->count && !found; i++) {
+        ideobj* value = ideobj_unwrap(env, items->cell[i]);
+        if (value->type == IDEOBJ_ERR) {
+            ideobj_del(obj);
+            return value;
+        }
+        found = ideobj_eq(needle, value);
+        ideobj_del(value);
+    }
+
+    ideobj_del(obj);
+    return ideobj_num(found);
+}
+
+// Folds the elements of a sequence with op, an element at a time
+ideobj* ideseq_fold_arith(ideenv* env, ideobj* obj, int op, long identity) {
+    ideobj* acc = ideobj_num(identity);
+    idecursor* cursor = idecursor_new(obj->cell[0]);
+    ideobj* value;
+    while (acc->type != IDEOBJ_ERR && (value = idecursor_next(env, cursor))) {
+        ideobj* values[2] = { acc, value };
+        acc = value->type == IDEOBJ_ERR
+            ? ideobj_copy(value)
+            : idearith_apply(op, values, 2, NULL);
+        ideobj_del(values[0]);
+        ideobj_del(value);
+    }
+
+    idecursor_del(cursor);
+    ideobj_del(obj);
+    return acc;
+}
+
+// Folds the unwrapped elements of a list with op, starting from identity
+ideobj* builtin_fold_arith(
+    ideenv* env, ideobj* obj, char* func, int op, long identity
+) {
+    IASSERT_NUM(func, obj, 1);
+    if (obj->cell[0]->type == IDEOBJ_SEQ) {
+        return ideseq_fold_arith(env, obj, op, identity);
+    }
+    IASSERT_TYPE(func, obj, 0, IDEOBJ_QEXPR);
+
+    ideobj* items = obj->cell[0];
+    if (items->count == 0) {
+        ideobj_del(obj);
+        return ideobj_num(identity);
+    }
+
+    ideobj** values = malloc(sizeof(ideobj*) * items->count);
+    int count = 0;
+    ideobj* result = NULL;
+
+    while (count < items->count) {
+        values[count] = ideobj_unwrap(env, items->cell[count]);
+        if (values[count++]->type == IDEOBJ_ERR) {
+            result = ideobj_copy(values[count - 1]);
+            break;
+        }
+    }
+
+    if (!result) {
+        result = idearith_apply(op, values, count, NULL);
+    }
+
+    for (int i=0; i<count; i++) {
+        ideobj_del(values[i]);
+    }
+    free(values);
+    ideobj_del(obj);
+    return result;
+}
+
+ideobj* builtin_sum(ideenv* env, ideobj* obj) {
+    return builtin_fold_arith(env, obj, "sum", IDEARITH_ADD, 0);
+}
+
+ideobj* builtin_product(ideenv* env, ideobj* obj) {
+    return builtin_fold_arith(env, obj, "product", IDEARITH_MUL, 1);
+}
+
+ideobj* builtin_flatten(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("flatten", obj, 1);
+    IASSERT_TYPE("flatten", obj, 0, IDEOBJ_QEXPR);
+
+    ideobj* result = ideobj_qexpr();
+
+    // Nested lists are walked from a stack of the lists being flattened
+    // and the index of their next element
+    int capacity = 16;
+    int depth = 1;
+    ideobj** lists = malloc(sizeof(ideobj*) * capacity);
+    int* next = malloc(sizeof(int) * capacity);
+    lists[0] = ideobj_copy(obj->cell[0]);
+    next[0] = 0;
+
+    while (depth) {
+        ideobj* list = lists[depth - 1];
+        if (next[depth - 1] == list->count) {
+            ideobj_del(list);
+            depth--;
+            continue;
+        }
+
+        ideobj* value = ideobj_unwrap(env, list->cell[next[depth - 1]++]);
+        if (value->type == IDEOBJ_ERR) {
+            while (depth) {
+                ideobj_del(lists[--depth]);
+            }
+            ideobj_del(result);
+            result = value;
+            break;
+        }
+
+        if (value->type != IDEOBJ_QEXPR) {
+            ideobj_list_add(result, value);
+            continue;
+        }
+
+        if (depth == capacity) {
+            capacity *= 2;
+            lists = realloc(lists, sizeof(ideobj*) * capacity);
+            next = realloc(next, sizeof(int) * capacity);
+        }
+        lists[depth] = value;
+        next[depth++] = 0;
+    }
+
+    free(lists);
+    free(next);
+    ideobj_del(obj);
+    return result;
+}
+
+ideobj* builtin_str_join(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("str-join", obj, 1);
+    IASSERT_TYPE("str-join", obj, 0, IDEOBJ_QEXPR);
+
+    ideobj* items = obj->cell[0];
+    ideobj** values = malloc(sizeof(ideobj*) * (items->count + 1));
+    int count = 0;
+    ideobj* result = NULL;
+
+    while (count < items->count) {
+        ideobj* value = ideobj_unwrap(env, items->cell[count]);
+        values[count++] = value;
+
+        if (value->type == IDEOBJ_ERR) {
+            result = ideobj_copy(value);
+            break;
+        }
+        if (value->type != IDEOBJ_STR) {
+            result = ideobj_err("Function 'concat' passed incorrect type");
+            break;
+        }
+    }
+
+    if (!result) {
+        result = idestr_join(values, count);
+    }
+
+    for (int i=0; i<count; i++) {
+        ideobj_del(values[i]);
+    }
+    free(values);
+    ideobj_del(obj);
+    return result;
+}
+
+// Function bodies are compiled to bytecode on their first call and run by
+// a stack machine, see idevm_run. Compiled code evaluates cells in the
+// same order as ideobj_eval_sexpr and applies them with ideobj_apply, so
+// errors surface the same way. An `if` with quoted branches is compiled
+// to jumps, with a fallback to a plain call for when `if` is rebound or
+// its arguments are invalid, and special forms the same way. Calls to
+// functions push a frame on the
+// machine instead of recursing, and calls in tail position replace the
+// caller's frame. Each op is followed by its arguments in `ops`.
+enum {
+    IDEOP_CONST,     // const: push a constant
+    IDEOP_LOAD,      // const: push the value of a symbol
+    IDEOP_MAP,       // const: push an evaluated hash map
+    IDEOP_IF,        // else, call: branch on the `if` and condition pushed last
+    IDEOP_FORM,      // form, call: pop the head if it is the special form
+    IDEOP_TEST,      // test, next, end: check the value pushed last
+    IDEOP_POP,
+    IDEOP_JUMP,      // target
+    IDEOP_CALL,      // count: apply the last count values
+    IDEOP_TAILCALL,  // count: apply, replacing the current frame
+    IDEOP_RETURN,
+};
+
+typedef struct idecode {
+    int* ops;
+    int count;
+    int capacity;
+    ideobj** consts;
+    int consts_count;
+} idecode;
+
+typedef struct ideframe {
+    idecode* code;
+    int pc;
+    ideenv* env;
+    ideobj* fun;
+} ideframe;
+
+// One machine is shared by every idevm_run, nested runs from builtins
+// that evaluate continue on top of the frames and values already there
+typedef struct idevm {
+    ideobj** values;
+    int count;
+    int capacity;
+    ideframe* frames;
+    int frame_count;
+    int frame_capacity;
+} idevm;
+
+idevm vm;
+
+// The funs and values the machine holds, and the envs of its frames
+void idevm_roots(idestack* roots, ideenv_stack* envs) {
+    for (int i=0; i<vm.frame_count; i++) {
+        idestack_push(roots, vm.frames[i].fun);
+        ideenv_stack_push(envs, vm.frames[i].env);
+    }
+    for (int i=0; i<vm.count; i++) {
+        idestack_push(roots, vm.values[i]);
+    }
+}
+
+void idecode_free(idecode* code) {
+    for (int i=0; i<code->consts_count; i++) {
+        ideobj_del(code->consts[i]);
+    }
+    free(code->consts);
+    free(code->ops);
+    free(code);
+}
+
+int idecode_emit(idecode* code, int op) {
+    if (code->count == code->capacity) {
+        code->capacity = code->capacity ? code->capacity * 2 : 16;
+        code->ops = realloc(code->ops, sizeof(int) * code->capacity);
+    }
+    code->ops[code->count] = op;
+    return code->count++;
+}
+
+int idecode_const(idecode* code, ideobj* obj) {
+    code->consts = realloc(
+        code->consts, sizeof(ideobj*) * (code->consts_count + 1)
+    );
+    code->consts[code->consts_count] = ideobj_copy(obj);
+    return code->consts_count++;
+}
+
+void idevm_compile(idecode* code, ideobj* expr, int tail);
+
+int idevm_is_if(ideobj* list) {
+    return list->count == 4
+        && list->cell[0]->type == IDEOBJ_SYMBOL
+        && list->cell[0]->symbol == ideintern("if")
+        && list->cell[2]->type == IDEOBJ_QEXPR
+        && list->cell[3]->type == IDEOBJ_QEXPR;
+}
+
+// How IDEOP_TEST checks the value pushed last. An error always ends the
+// form with it. Value only checks for the error, the other tests pop the
+// value: and/or end the form with their result when it decides it, cond
+// jumps to the next clause when false and case when the key does not
+// equal the needle below it, which a match pops as well.
+enum {
+    IDETEST_VALUE,
+    IDETEST_AND,
+    IDETEST_OR,
+    IDETEST_COND,
+    IDETEST_CASE
+};
+
+// Returns the special form list calls by name
+int idevm_form(ideobj* list) {
+    if (list->count < 2 || list->cell[0]->type != IDEOBJ_SYMBOL) {
+        return IDEFORM_NONE;
+    }
+
+    for (int form=0; form<=IDEFORM_CASE; form++) {
+        if (list->cell[0]->symbol == ideintern(ideform_names[form])) {
+            return form;
+        }
+    }
+    return IDEFORM_NONE;
+}
+
+// Returns whether the operands of form have the shape the machine
+// compiles, cond and case clauses written out as '(test value)
+int idevm_form_compiles(ideobj* list, int form) {
+    int clauses = form == IDEFORM_COND ? 1 : form == IDEFORM_CASE ? 2 : 0;
+    for (int i=clauses; clauses && i<list->count; i++) {
+        ideobj* clause = list->cell[i];
+        if (clause->type != IDEOBJ_QEXPR || clause->count != 2) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void idevm_emit_test(idecode* code, int test, int* next, int* end) {
+    idecode_emit(code, IDEOP_TEST);
+    idecode_emit(code, test);
+    *next = idecode_emit(code, 0);
+    *end = idecode_emit(code, 0);
+}
+
+void idevm_emit_const(idecode* code, ideobj* obj) {
+    idecode_emit(code, IDEOP_CONST);
+    idecode_emit(code, idecode_const(code, obj));
+    ideobj_del(obj);
+}
+
+// Compiles a special form to tests and jumps, falling back to a plain
+// call when its name is bound to something else
+void idevm_compile_form(idecode* code, ideobj* list, int form, int tail) {
+    idevm_compile(code, list->cell[0], 0);
+    int guard = idecode_emit(code, IDEOP_FORM);
+    idecode_emit(code, form);
+    idecode_emit(code, 0);
+
+    // Placeholders for the jumps to the end of the form
+    int* ends = malloc(sizeof(int) * list->count * 2);
+    int count = 0;
+    int next;
+
+    if (form == IDEFORM_AND || form == IDEFORM_OR) {
+        for (int i=1; i<list->count; i++) {
+            idevm_compile(code, list->cell[i], 0);
+            int test = form == IDEFORM_AND ? IDETEST_AND : IDETEST_OR;
+            idevm_emit_test(code, test, &next, &ends[count++]);
+        }
+        idevm_emit_const(code, ideobj_num(form == IDEFORM_AND));
+    } else {
+        int first = 1;
+        if (form == IDEFORM_CASE) {
+            idevm_compile(code, list->cell[1], 0);
+            idevm_emit_test(code, IDETEST_VALUE, &next, &ends[count++]);
+            first = 2;
+        }
+
+        for (int i=first; i<list->count; i++) {
+            ideobj* clause = list->cell[i];
+            int test = form == IDEFORM_COND ? IDETEST_COND : IDETEST_CASE;
+            idevm_compile(code, clause->cell[0], 0);
+            idevm_emit_test(code, test, &next, &ends[count++]);
+            idevm_compile(code, clause->cell[1], tail);
+            if (!tail) {
+                idecode_emit(code, IDEOP_JUMP);
+                ends[count++] = idecode_emit(code, 0);
+            }
+            code->ops[next] = code->count;
+        }
+
+        if (form == IDEFORM_CASE) {
+            idecode_emit(code, IDEOP_POP);
+        }
+        idevm_emit_const(code, ideobj_err("No matching case found"));
+    }
+
+    if (tail) {
+        idecode_emit(code, IDEOP_RETURN);
+    } else {
+        idecode_emit(code, IDEOP_JUMP);
+        ends[count++] = idecode_emit(code, 0);
+    }
+
+    code->ops[guard + 2] = code->count;
+    for (int i=1; i<list->count; i++) {
+        idevm_compile(code, list->cell[i], 0);
+    }
+    idecode_emit(code, tail ? IDEOP_TAILCALL : IDEOP_CALL);
+    idecode_emit(code, list->count);
+
+    for (int i=0; i<count; i++) {
+        code->ops[ends[i]] = code->count;
+    }
+    if (tail) {
+        idecode_emit(code, IDEOP_RETURN);
+    }
+    free(ends);
+}
+
+// Compiles a special form the machine doesn't compile to jumps to a
+// call passing the builtin its operands unevaluated, as the tree walker
+// does, or to a plain call when its name is bound to something else
+void idevm_compile_form_call(idecode* code, ideobj* list, int form, int tail) {
+    idevm_compile(code, list->cell[0], 0);
+    int guard = idecode_emit(code, IDEOP_FORM);
+    idecode_emit(code, form);
+    idecode_emit(code, 0);
+
+    // The guard popped the head it checked
+    idevm_compile(code, list->cell[0], 0);
+    for (int i=1; i<list->count; i++) {
+        idecode_emit(code, IDEOP_CONST);
+        idecode_emit(code, idecode_const(code, list->cell[i]));
+    }
+    idecode_emit(code, tail ? IDEOP_TAILCALL : IDEOP_CALL);
+    idecode_emit(code, list->count);
+
+    int end = 0;
+    if (!tail) {
+        idecode_emit(code, IDEOP_JUMP);
+        end = idecode_emit(code, 0);
+    }
+
+    code->ops[guard + 2] = code->count;
+    for (int i=1; i<list->count; i++) {
+        idevm_compile(code, list->cell[i], 0);
+    }
+    idecode_emit(code, tail ? IDEOP_TAILCALL : IDEOP_CALL);
+    idecode_emit(code, list->count);
+
+    if (!tail) {
+        code->ops[end] = code->count;
+    }
+}
+
+// Compiles the cells of list as one s-expression
+void idevm_compile_sexpr(idecode* code, ideobj* list, int tail) {
+    // Expressions too deep to compile evaluate to the error instead
+    if (idedepth_stack_exceeded()) {
+        ideobj* err = ideobj_err("Expression nested too deeply");
+        idecode_emit(code, IDEOP_CONST);
+        idecode_emit(code, idecode_const(code, err));
+        ideobj_del(err);
+        if (tail) {
+            idecode_emit(code, IDEOP_RETURN);
+        }
+        return;
+    }
+
+    if (list->count == 0) {
+        ideobj* empty = ideobj_sexpr();
+        idecode_emit(code, IDEOP_CONST);
+        idecode_emit(code, idecode_const(code, empty));
+        ideobj_del(empty);
+        if (tail) {
+            idecode_emit(code, IDEOP_RETURN);
+        }
+        return;
+    }
+
+    int form = idevm_form(list);
+    if (form != IDEFORM_NONE && idevm_form_compiles(list, form)) {
+        idevm_compile_form(code, list, form, tail);
+        return;
+    }
+    if (form != IDEFORM_NONE) {
+        idevm_compile_form_call(code, list, form, tail);
+        return;
+    }
+
+    if (!idevm_is_if(list)) {
+        for (int i=0; i<list->count; i++) {
+            idevm_compile(code, list->cell[i], 0);
+        }
+        idecode_emit(code, tail ? IDEOP_TAILCALL : IDEOP_CALL);
+        idecode_emit(code, list->count);
+        return;
+    }
+
+    idevm_compile(code, list->cell[0], 0);
+    idevm_compile(code, list->cell[1], 0);
+    int branch = idecode_emit(code, IDEOP_IF);
+    idecode_emit(code, 0);
+    idecode_emit(code, 0);
+
+    // Branches in tail position end in a return, the others jump past
+    // the fallback call
+    int ends[2];
+    for (int i=0; i<2; i++) {
+        if (i == 1) {
+            code->ops[branch + 1] = code->count;
+        }
+        idevm_compile_sexpr(code, list->cell[2 + i], tail);
+        if (!tail) {
+            idecode_emit(code, IDEOP_JUMP);
+            ends[i] = idecode_emit(code, 0);
+        }
+    }
+
+    code->ops[branch + 2] = code->count;
+    idevm_compile(code, list->cell[2], 0);
+    idevm_compile(code, list->cell[3], 0);
+    idecode_emit(code, tail ? IDEOP_TAILCALL : IDEOP_CALL);
+    idecode_emit(code, 4);
+
+    if (!tail) {
+        code->ops[ends[0]] = code->count;
+        code->ops[ends[1]] = code->count;
+    }
+}
+
+void idevm_compile(idecode* code, ideobj* expr, int tail) {
+    switch (expr->type) {
+        case IDEOBJ_SEXPR:
+            idevm_compile_sexpr(code, expr, tail);
+            return;
+        case IDEOBJ_SYMBOL:
+            idecode_emit(code, IDEOP_LOAD);
+            break;
+        case IDEOBJ_HASHMAP:
+            idecode_emit(code, IDEOP_MAP);
+            break;
+        default:
+            idecode_emit(code, IDEOP_CONST);
+            break;
+    }
+
+    idecode_emit(code, idecode_const(code, expr));
+    if (tail) {
+        idecode_emit(code, IDEOP_RETURN);
+    }
+}
+
+// Returns the code for a function body, compiled on first use and kept
+// with the body's cells until they change
+idecode* idevm_code(ideobj* body) {
+    idecells* buffer = body->base ? NULL : idelist_buffer(body);
+    if (buffer && buffer->code) {
+        return buffer->code;
+    }
+
+    idecode* code = calloc(1, sizeof(idecode));
+    idevm_compile_sexpr(code, body, 1);
+    if (buffer) {
+        buffer->code = code;
+        body->compiled = 1;
+    }
+    return code;
+}
+
+void idevm_push(ideobj* obj) {
+    if (vm.count == vm.capacity) {
+        vm.capacity = vm.capacity ? vm.capacity * 2 : 64;
+        vm.values = realloc(vm.values, sizeof(ideobj*) * vm.capacity);
+    }
+    vm.values[vm.count++] = obj;
+}
+
+void idevm_push_frame(ideobj* fun, ideenv* env) {
+    if (vm.frame_count == vm.frame_capacity) {
+        vm.frame_capacity = vm.frame_capacity ? vm.frame_capacity * 2 : 16;
+        vm.frames = realloc(vm.frames, sizeof(ideframe) * vm.frame_capacity);
+    }
+
+    ideframe* frame = &vm.frames[vm.frame_count++];
+    frame->code = idevm_code(fun->body);
+    frame->pc = 0;
+    frame->env = env;
+    frame->fun = fun;
+}
+
+void idevm_pop_frame(void) {
+    ideframe* frame = &vm.frames[--vm.frame_count];
+
+    // Bodies without a buffer to keep their code in compile on every call
+    idecells* buffer = frame->fun->body->base
+        ? NULL
+        : idelist_buffer(frame->fun->body);
+    if (!buffer || buffer->code != frame->code) {
+        idecode_free(frame->code);
+    }
+
+    ideenv_del(frame->env);
+    ideobj_del(frame->fun);
+}
+
+ideobj* idevm_depth_err(void) {
+    return ideobj_err(
+        "Maximum call depth of %li exceeded", idedepth_max_frames
+    );
+}
+
+// Runs the body of fun in its bound call frame env, taking both
+ideobj* idevm_run(ideobj* fun, ideenv* env) {
+    if (vm.frame_count >= idedepth_max_frames) {
+        ideenv_del(env);
+        ideobj_del(fun);
+        return idevm_depth_err();
+    }
+
+    int base = vm.frame_count;
+    idevm_push_frame(fun, env);
+    idegc_safepoint();
+
+    while (1) {
+        // Anything that evaluates can run the machine again and move the
+        // frames, so frame is only used up to the next such call
+        ideframe* frame = &vm.frames[vm.frame_count - 1];
+        int* ops = frame->code->ops;
+        ideobj** consts = frame->code->consts;
+        int op = ops[frame->pc++];
+        ideobj* result = NULL;
+
+        switch (op) {
+            case IDEOP_CONST:
+                idevm_push(ideobj_copy(consts[ops[frame->pc++]]));
+                continue;
+            case IDEOP_LOAD:
+                idevm_push(ideenv_lookup(frame->env, consts[ops[frame->pc++]]));
+                continue;
+            case IDEOP_MAP: {
+                ideobj* map = ideobj_copy(consts[ops[frame->pc++]]);
+                idevm_push(ideobj_eval_hashmap(frame->env, map));
+                continue;
+            }
+            case IDEOP_JUMP:
+                frame->pc = ops[frame->pc];
+                continue;
+            case IDEOP_POP:
+                ideobj_del(vm.values[--vm.count]);
+                continue;
+            case IDEOP_FORM: {
+                ideobj* head = vm.values[vm.count - 1];
+                if (
+                    head->type != IDEOBJ_BUILTIN ||
+                    head->form != ops[frame->pc]
+                ) {
+                    frame->pc = ops[frame->pc + 1];
+                    continue;
+                }
+
+                frame->pc += 2;
+                vm.count--;
+                ideobj_del(head);
+                continue;
+            }
+            case IDEOP_TEST: {
+                int test = ops[frame->pc];
+                int next = ops[frame->pc + 1];
+                int end = ops[frame->pc + 2];
+                frame->pc += 3;
+
+                ideobj* value = vm.values[vm.count - 1];
+                if (value->type == IDEOBJ_ERR) {
+                    // The needle below a key is dropped with the form
+                    if (test == IDETEST_CASE) {
+                        ideobj_del(vm.values[vm.count - 2]);
+                        vm.values[vm.count - 2] = value;
+                        vm.count--;
+                    }
+                    frame->pc = end;
+                    continue;
+                }
+                if (test == IDETEST_VALUE) {
+                    continue;
+                }
+
+                if (test == IDETEST_COND && value->type != IDEOBJ_NUM) {
+                    vm.values[vm.count - 1] = ideform_test_err("cond", value);
+                    ideobj_del(value);
+                    frame->pc = end;
+                    continue;
+                }
+
+                vm.count--;
+                if (test == IDETEST_CASE) {
+                    int match = ideobj_eq(vm.values[vm.count - 1], value);
+                    ideobj_del(value);
+                    if (match) {
+                        ideobj_del(vm.values[--vm.count]);
+                    } else {
+                        frame->pc = next;
+                    }
+                    continue;
+                }
+
+                int truthy = ideobj_truthy(value);
+                ideobj_del(value);
+                if (test == IDETEST_COND) {
+                    if (!truthy) {
+                        frame->pc = next;
+                    }
+                } else if (truthy == (test == IDETEST_OR)) {
+                    idevm_push(ideobj_num(truthy));
+                    frame->pc = end;
+                }
+                continue;
+            }
+            case IDEOP_IF: {
+                ideobj* head = vm.values[vm.count - 2];
+                ideobj* condition = vm.values[vm.count - 1];
+
+                if (
+                    head->type != IDEOBJ_BUILTIN ||
+                    head->builtin != builtin_if ||
+                    condition->type != IDEOBJ_NUM
+                ) {
+                    frame->pc = ops[frame->pc + 1];
+                    continue;
+                }
+
+                int truthy = ideobj_truthy(condition);
+                frame->pc = truthy ? frame->pc + 2 : ops[frame->pc];
+                vm.count -= 2;
+                ideobj_del(head);
+                ideobj_del(condition);
+                continue;
+            }
+            case IDEOP_CALL:
+            case IDEOP_TAILCALL: {
+                int count = ops[frame->pc++];
+                ideobj** values = &vm.values[vm.count - count];
+
+                // Arithmetic on numbers is applied in place on the stack
+                if (
+                    count > 1 &&
+                    values[0]->type == IDEOBJ_BUILTIN &&
+                    values[0]->arith != IDEARITH_NONE
+                ) {
+                    result = idearith_call(
+                        values[0]->arith, &values[1], count - 1
+                    );
+                    if (result) {
+                        for (int i=0; i<count; i++) {
+                            ideobj_del(values[i]);
+                        }
+                        vm.count -= count;
+
+                        if (op == IDEOP_CALL) {
+                            idevm_push(result);
+                            continue;
+                        }
+                        break;
+                    }
+                }
+
+                ideobj* expr = ideobj_sexpr();
+                idelist_reserve(expr, count);
+                memcpy(
+                    expr->cell,
+                    &vm.values[vm.count - count],
+                    sizeof(ideobj*) * count
+                );
+                expr->count = count;
+                vm.count -= count;
+
+                ideenv* callee = NULL;
+                result = ideobj_apply(frame->env, expr, &callee);
+
+                if (callee) {
+                    // Dropping the frame we are replacing keeps loops,
+                    // mutual recursion included, in constant memory
+                    if (op == IDEOP_TAILCALL) {
+                        ideenv_skip_caller(callee);
+                        idevm_pop_frame();
+                    } else if (vm.frame_count >= idedepth_max_frames) {
+                        ideenv_del(callee);
+                        ideobj_del(result);
+                        idevm_push(idevm_depth_err());
+                        continue;
+                    }
+                    idevm_push_frame(result, callee);
+                    idegc_safepoint();
+                    continue;
+                }
+
+                if (op == IDEOP_CALL) {
+                    idevm_push(result);
+                    continue;
+                }
+                break;
+            }
+            case IDEOP_RETURN:
+                result = vm.values[--vm.count];
+                break;
+        }
+
+        idevm_pop_frame();
+        if (vm.frame_count == base) {
+            return result;
+        }
+        idevm_push(result);
+    }
+}
+
+// Source being read. When reading from a file the source is a window on
+// it, refilled between top-level expressions, with the row and column its
+// first byte is at. Errors report where reading stopped as the file, row
+// and column, in the same form the grammar used to.
+typedef struct idereader {
+    char* filename;
+    char* source;
+    char* pos;
+    FILE* file;
+    long size;
+    long capacity;
+    long row;
+    long col;
+    int failed;
+} idereader;
+
+#define IDEREAD_EXPECT_EXPR \
+    "'(', '{', \"'(\", decimal, number, string, keyword, symbol or comment"
+
+ideobj* ideread_err(idereader* reader, char* expected) {
+    long row = reader->row;
+    long col = reader->col;
+    for (char* c = reader->source; c < reader->pos; c++) {
+        if (*c == '\n') {
+            row++;
+            col = 1;
+        } else {
+            col++;
+        }
+    }
+
+    char at[16];
+    if (!*reader->pos) {
+        strcpy(at, "end of input");
+    } else if (*reader->pos == '\n') {
+        strcpy(at, "newline");
+    } else {
+        snprintf(at, sizeof(at), "'%c'", *reader->pos);
+    }
+
+    return ideobj_err(
+        "%s:%li:%li: error: expected %s at %s",
+        reader->filename, row, col, expected, at
+    );
+}
+
+int ideread_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int ideread_symbol_char(char c) {
+    if (
+        (c >= 'a' && c <= 'z') ||
+        (c >= 'A' && c <= 'Z') ||
+        ideread_digit(c)
+    ) {
+        return 1;
+    }
+
+    switch (c) {
+        case '_': case '+': case '^': case '-': case '*': case '/':
+        case '\\': case '=': case '<': case '>': case '!': case '&':
+        case '%': case '?':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Skips whitespace and comments up to the next token
+void ideread_skip(idereader* reader) {
+    char* c = reader->pos;
+    while (1) {
+        if (*c == ' ' || (*c >= '\t' && *c <= '\r')) {
+            c++;
+        } else if (*c == ';') {
+            while (*c && *c != '\n' && *c != '\r') {
+                c++;
+            }
+        } else {
+            break;
+        }
+    }
+    reader->pos = c;
+}
+
+// Tokens are terminated in place while they are converted, so the source
+// must be writable
+ideobj* ideread_token(char* start, char* end, int type) {
+    char saved = *end;
+    *end = '\0';
+
+    ideobj* value;
+    errno = 0;
+    switch (type) {
+        case IDEOBJ_DECIMAL: {
+            double decimal = strtod(start, NULL);
+            value = errno == ERANGE
+                ? ideobj_err("Invalid number")
+                : ideobj_decimal(decimal);
+            break;
+        }
+        case IDEOBJ_NUM: {
+            long num = strtol(start, NULL, 10);
+            value = errno == ERANGE
+                ? ideobj_err("Invalid number")
+                : ideobj_num(num);
+            break;
+        }
+        case IDEOBJ_KEYWORD:
+            value = ideobj_keyword(start);
+            break;
+        default:
+            value = ideobj_symbol(start);
+            break;
+    }
+
+    *end = saved;
+    return value;
+}
+
+// Reads a string literal, resolving the escapes C does
+ideobj* ideread_string(idereader* reader) {
+    char* end = reader->pos + 1;
+    while (*end && *end != '"') {
+        end += end[0] == '\\' && end[1] ? 2 : 1;
+    }
+    if (!*end) {
+        return NULL;
+    }
+
+    char* unescaped = malloc(end - reader->pos);
+    char* out = unescaped;
+    for (char* c = reader->pos + 1; c < end; c++) {
+        if (*c != '\\') {
+            *out++ = *c;
+            continue;
+        }
+
+        switch (*++c) {
+            case 'a': *out++ = '\a'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'v': *out++ = '\v'; break;
+            case '0': *out++ = '\0'; break;
+            case '\\': case '\'': case '"': *out++ = *c; break;
+            default:
+                *out++ = '\\';
+                *out++ = *c;
+                break;
+        }
+    }
+    *out = '\0';
+
+    reader->pos = end + 1;
+    ideobj* obj = ideobj_str(unescaped);
+    free(unescaped);
+    return obj;
+}
+
+// Reads the atom at the reader's position, or NULL when none starts there.
+// Numbers are tried before symbols, so "-" alone and "-x" are symbols.
+ideobj* ideread_atom(idereader* reader) {
+    char* start = reader->pos;
+    char* c = start;
+
+    if (*c == '"') {
+        return ideread_string(reader);
+    }
+
+    if (*c == ':') {
+        while (ideread_symbol_char(*++c));
+        if (c == start + 1) {
+            return NULL;
+        }
+        reader->pos = c;
+        return ideread_token(start + 1, c, IDEOBJ_KEYWORD);
+    }
+
+    if (*c == '-') {
+        c++;
+    }
+    if (ideread_digit(*c)) {
+        while (ideread_digit(*++c));
+        int type = IDEOBJ_NUM;
+        if (*c == '.' && ideread_digit(c[1])) {
+            c++;
+            while (ideread_digit(*++c));
+            type = IDEOBJ_DECIMAL;
+        }
+        reader->pos = c;
+        return ideread_token(start, c, type);
+    }
+
+    c = start;
+    while (ideread_symbol_char(*c)) {
+        c++;
+    }
+    if (c == start) {
+        return NULL;
+    }
+    reader->pos = c;
+    return ideread_token(start, c, IDEOBJ_SYMBOL);
+}
+
+// Lists being read and the character closing them. A map also holds the
+// key read last until its value is.
+typedef struct ideread_frame {
+    ideobj* value;
+    ideobj* key;
+    char close;
+} ideread_frame;
+
+typedef struct ideread_stack {
+    ideread_frame* frames;
+    int count;
+    int capacity;
+} ideread_stack;
+
+ideread_stack ideread_frames;
+
+void ideread_push(ideobj* value, char close) {
+    if (ideread_frames.count == ideread_frames.capacity) {
+        ideread_frames.capacity = ideread_frames.capacity
+            ? ideread_frames.capacity * 2
+            : 16;
+        ideread_frames.frames = realloc(
+            ideread_frames.frames,
+            sizeof(ideread_frame) * ideread_frames.capacity
+        );
+    }
+    ideread_frames.frames[ideread_frames.count++] =
+        (ideread_frame) { value, NULL, close };
+}
+
+// Adds a value read inside frame to the list or map it builds
+void ideread_add(ideread_frame* frame, ideobj* value) {
+    if (frame->value->type != IDEOBJ_HASHMAP) {
+        frame->value = ideobj_list_add(frame->value, value);
+    } else if (!frame->key) {
+        frame->key = value;
+    } else {
+        frame->value = ideobj_hashmap_add(frame->value, frame->key, value);
+        frame->key = NULL;
+    }
+}
+
+// Reads one expression in a single pass over the bytes, or returns NULL at
+// the end of the source. Lists are kept on an explicit stack, so nesting
+// is only bounded by memory.
+ideobj* ideread_expr(idereader* reader) {
+    int base = ideread_frames.count;
+
+    while (1) {
+        ideread_skip(reader);
+        ideread_frame* frame = ideread_frames.count > base
+            ? &ideread_frames.frames[ideread_frames.count - 1]
+            : NULL;
+        char c = *reader->pos;
+        ideobj* value = NULL;
+
+        if (frame && c == frame->close) {
+            reader->pos++;
+            value = frame->value;
+            if (frame->key) {
+                ideobj_del(frame->key);
+            }
+            ideread_frames.count--;
+        } else if (c == '(') {
+            reader->pos++;
+            ideread_push(ideobj_sexpr(), ')');
+            continue;
+        } else if (c == '\'' && reader->pos[1] == '(') {
+            reader->pos += 2;
+            ideread_push(ideobj_qexpr(), ')');
+            continue;
+        } else if (c == '{') {
+            reader->pos++;
+            ideread_push(ideobj_hashmap(), '}');
+            continue;
+        } else if (c) {
+            value = ideread_atom(reader);
+        } else if (!frame) {
+            return NULL;
+        }
+
+        if (value) {
+            if (ideread_frames.count == base) {
+                return value;
+            }
+            ideread_add(&ideread_frames.frames[ideread_frames.count - 1], value);
+            continue;
+        }
+
+        ideobj* err;
+        if (!c) {
+            char expected[96];
+            snprintf(
+                expected, sizeof(expected),
+                IDEREAD_EXPECT_EXPR " or '%c'", frame->close
+            );
+            err = ideread_err(reader, expected);
+        } else {
+            err = ideread_err(reader, IDEREAD_EXPECT_EXPR);
+        }
+
+        while (ideread_frames.count > base) {
+            frame = &ideread_frames.frames[--ideread_frames.count];
+            ideobj_del(frame->value);
+            if (frame->key) {
+                ideobj_del(frame->key);
+            }
+        }
+        reader->failed = 1;
+        return err;
+    }
+}
+
+// Drops the source read so far and appends the next chunk of the file,
+// growing the window when one expression doesn't fit. Returns 0 at the
+// end of the file.
+int ideread_fill(idereader* reader) {
+    char* end = reader->source + reader->size;
+    for (char* c = reader->source; c < reader->pos; c++) {
+        if (*c == '\n') {
+            reader->row++;
+            reader->col = 1;
+        } else {
+            reader->col++;
+        }
+    }
+    reader->size = end - reader->pos;
+    memmove(reader->source, reader->pos, reader->size);
+    reader->pos = reader->source;
+
+    if (reader->capacity - reader->size - 1 < reader->size) {
+        reader->capacity *= 2;
+        reader->source = realloc(reader->source, reader->capacity);
+        reader->pos = reader->source;
+    }
+
+    size_t read = fread(
+        reader->source + reader->size, 1,
+        reader->capacity - reader->size - 1,
+        reader->file
+    );
+    reader->size += read;
+    reader->source[reader->size] = '\0';
+    return read > 0;
+}
+
+// Reads the next top-level expression. From a file, an expression that
+// fails or runs up to the end of the window may continue past it, so it
+// is read again with more of the file until it ends before the window
+// does or the file does.
+ideobj* ideread_next(idereader* reader) {
+    while (1) {
+        char* start = reader->pos;
+        ideobj* value = ideread_expr(reader);
+
+        if (
+            !reader->file || (
+                value && !reader->failed &&
+                reader->pos < reader->source + reader->size
+            )
+        ) {
+            return value;
+        }
+
+        if (value) {
+            ideobj_del(value);
+        }
+        reader->pos = start;
+        reader->failed = 0;
+        if (!ideread_fill(reader)) {
+            reader->file = NULL;
+        }
+    }
+}
+
+// Starts reading a file, one top-level expression at a time
+idereader ideread_open(char* filename, FILE* file) {
+    idereader reader = { filename, NULL, NULL, file, 0, 1 << 16, 1, 1, 0 };
+    reader.source = malloc(reader.capacity);
+    reader.source[0] = '\0';
+    reader.pos = reader.source;
+    return reader;
+}
+
+// Reads every expression in source into an S-Expression
+ideobj* ideobj_read(char* filename, char* source) {
+    idereader reader = { filename, source, source, NULL, 0, 0, 1, 1, 0 };
+    ideobj* expressions = ideobj_sexpr();
+
+    ideobj* value;
+    while ((value = ideread_next(&reader))) {
+        if (reader.failed) {
+            ideobj_del(expressions);
+            return value;
+        }
+        expressions = ideobj_list_add(expressions, value);
+    }
+    return expressions;
+}
+
+// Every builtin by name, filled in as builtins are added to an env, so
+// images can refer to builtins by name instead of by address
+typedef struct idebuiltin_name {
+    char* name;
+    ibuiltin builtin;
+} idebuiltin_name;
+
+typedef struct idebuiltin_table {
+    idebuiltin_name* names;
+    int count;
+    int capacity;
+} idebuiltin_table;
+
+idebuiltin_table idebuiltins;
+
+void idebuiltin_register(char* name, ibuiltin builtin) {
+    name = ideintern(name);
+    for (int i=0; i<idebuiltins.count; i++) {
+        if (idebuiltins.names[i].name == name) {
+            return;
+        }
+    }
+
+    if (idebuiltins.count == idebuiltins.capacity) {
+        idebuiltins.capacity = idebuiltins.capacity
+            ? idebuiltins.capacity * 2
+            : 64;
+        idebuiltins.names = realloc(
+            idebuiltins.names,
+            sizeof(idebuiltin_name) * idebuiltins.capacity
+        );
+    }
+    idebuiltins.names[idebuiltins.count++] =
+        (idebuiltin_name) { name, builtin };
+}
+
+char* idebuiltin_name_of(ibuiltin builtin) {
+    for (int i=0; i<idebuiltins.count; i++) {
+        if (idebuiltins.names[i].builtin == builtin) {
+            return idebuiltins.names[i].name;
+        }
+    }
+    return NULL;
+}
+
+ibuiltin idebuiltin_named(char* name) {
+    name = ideintern(name);
+    for (int i=0; i<idebuiltins.count; i++) {
+        if (idebuiltins.names[i].name == name) {
+            return idebuiltins.names[i].builtin;
+        }
+    }
+    return NULL;
+}
+
+// Binary encoding of values and the envs their functions close over,
+// used for images, load caches and serialize. Values are written children
+// first, so reading them back only takes a stack of values: a list record
+// pops the values read before it as its cells. Functions refer to their
+// env by number, and the envs follow as numbered records with their
+// bindings, since closures and the envs that bind them refer to each
+// other. Integers are zigzag varints, names are written out once and
+// numbered, decimals keep the host's layout.
+enum {
+    IDEBIN_END,
+    IDEBIN_NONE,
+    IDEBIN_NUM,
+    IDEBIN_DECIMAL,
+    IDEBIN_STR,
+    IDEBIN_ERR,
+    IDEBIN_SYMBOL,
+    IDEBIN_KEYWORD,
+    IDEBIN_BUILTIN,
+    IDEBIN_SEXPR,
+    IDEBIN_QEXPR,
+    IDEBIN_HASHMAP,
+    IDEBIN_FUN,
+    IDEBIN_SEQ,
+    IDEBIN_ENV,
+    IDEBIN_BIND
+};
+
+// Writes into data, which is flushed to file whenever it fills up when
+// there is one. Names written so far are kept in an open-addressed table
+// from the interned name to its number.
+typedef struct idebin_writer {
+    char* data;
+    long size;
+    long capacity;
+    FILE* file;
+    int failed;
+    ideenv** envs;
+    int env_count;
+    int env_capacity;
+    char** names;
+    long* name_ids;
+    long name_count;
+    long name_capacity;
+} idebin_writer;
+
+#define IDEBIN_CHUNK (1 << 16)
+
+void idebin_flush(idebin_writer* writer) {
+    if (writer->file && writer->size) {
+        if (fwrite(writer->data, 1, writer->size, writer->file) != (size_t) writer->size) {
+            writer->failed = 1;
+        }
+        writer->size = 0;
+    }
+}
+
+void idebin_put(idebin_writer* writer, void* bytes, long size) {
+    if (writer->file && writer->size + size > IDEBIN_CHUNK) {
+        idebin_flush(writer);
+    }
+    if (writer->size + size > writer->capacity) {
+        while (writer->size + size > writer->capacity) {
+            writer->capacity = writer->capacity ? writer->capacity * 2 : 4096;
+        }
+        writer->data = realloc(writer->data, writer->capacity);
+    }
+    memcpy(writer->data + writer->size, bytes, size);
+    writer->size += size;
+}
+
+void idebin_put_tag(idebin_writer* writer, unsigned char tag) {
+    idebin_put(writer, &tag, 1);
+}
+
+void idebin_put_long(idebin_writer* writer, long value) {
+    unsigned long zigzag = ((unsigned long) value << 1) ^ (value < 0 ? ~0UL : 0);
+    unsigned char bytes[10];
+    int count = 0;
+    while (zigzag >= 0x80) {
+        bytes[count++] = (zigzag & 0x7f) | 0x80;
+        zigzag >>= 7;
+    }
+    bytes[count++] = zigzag;
+    idebin_put(writer, bytes, count);
+}
+
+void idebin_put_str(idebin_writer* writer, char* str) {
+    long length = strlen(str);
+    idebin_put_long(writer, length);
+    idebin_put(writer, str, length);
+}
+
+// Writes the number of an interned name, followed by the name itself the
+// first time it is written
+void idebin_put_name(idebin_writer* writer, char* name) {
+    if ((writer->name_count + 1) * 2 > writer->name_capacity) {
+        long capacity = writer->name_capacity ? writer->name_capacity * 2 : 64;
+        char** names = calloc(capacity, sizeof(char*));
+        long* ids = malloc(sizeof(long) * capacity);
+
+        for (long i=0; i<writer->name_capacity; i++) {
+            if (writer->names[i]) {
+                unsigned long j = idehash_ptr(writer->names[i]) & (capacity - 1);
+                while (names[j]) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                names[j] = writer->names[i];
+                ids[j] = writer->name_ids[i];
+            }
+        }
+
+        free(writer->names);
+        free(writer->name_ids);
+        writer->names = names;
+        writer->name_ids = ids;
+        writer->name_capacity = capacity;
+    }
+
+    unsigned long i = idehash_ptr(name) & (writer->name_capacity - 1);
+    while (writer->names[i]) {
+        if (writer->names[i] == name) {
+            idebin_put_long(writer, writer->name_ids[i]);
+            return;
+        }
+        i = (i + 1) & (writer->name_capacity - 1);
+    }
+
+    writer->names[i] = name;
+    writer->name_ids[i] = writer->name_count++;
+    idebin_put_long(writer, writer->name_ids[i]);
+    idebin_put_str(writer, name);
+}
+
+// Numbers env, the first time it is seen it is queued for its record
+long idebin_env_id(idebin_writer* writer, ideenv* env) {
+    if (!env) {
+        return -1;
+    }
+    for (int i=0; i<writer->env_count; i++) {
+        if (writer->envs[i] == env) {
+            return i;
+        }
+    }
+
+    if (writer->env_count == writer->env_capacity) {
+        writer->env_capacity = writer->env_capacity
+            ? writer->env_capacity * 2
+            : 16;
+        writer->envs = realloc(
+            writer->envs,
+            sizeof(ideenv*) * writer->env_capacity
+        );
+    }
+    writer->envs[writer->env_count] = env;
+    return writer->env_count++;
+}
+
+// Writes the record for obj, after its children when it has any
+void idebin_put_obj(idebin_writer* writer, ideobj* obj) {
+    switch (obj->type) {
+        case IDEOBJ_NUM:
+            idebin_put_tag(writer, IDEBIN_NUM);
+            idebin_put_long(writer, obj->num);
+            break;
+        case IDEOBJ_DECIMAL:
+            idebin_put_tag(writer, IDEBIN_DECIMAL);
+            idebin_put(writer, &obj->decimal, sizeof(double));
+            break;
+        case IDEOBJ_STR:
+            idebin_put_tag(writer, IDEBIN_STR);
+            idebin_put_str(writer, obj->str);
+            break;
+        case IDEOBJ_ERR:
+            idebin_put_tag(writer, IDEBIN_ERR);
+            idebin_put_str(writer, obj->err);
+            break;
+        case IDEOBJ_SYMBOL:
+            idebin_put_tag(writer, IDEBIN_SYMBOL);
+            idebin_put_name(writer, obj->symbol);
+            idebin_put_long(writer, obj->depth);
+            idebin_put_long(writer, obj->slot);
+            break;
+        case IDEOBJ_KEYWORD:
+            idebin_put_tag(writer, IDEBIN_KEYWORD);
+            idebin_put_name(writer, obj->keyword);
+            break;
+        case IDEOBJ_BUILTIN: {
+            char* name = idebuiltin_name_of(obj->builtin);
+            idebin_put_tag(writer, IDEBIN_BUILTIN);
+            idebin_put_name(writer, name ? name : ideintern(""));
+            break;
+        }
+        case IDEOBJ_SEXPR:
+        case IDEOBJ_QEXPR:
+            idebin_put_tag(
+                writer,
+                obj->type == IDEOBJ_SEXPR ? IDEBIN_SEXPR : IDEBIN_QEXPR
+            );
+            idebin_put_long(writer, obj->count);
+            break;
+        case IDEOBJ_HASHMAP:
+            idebin_put_tag(writer, IDEBIN_HASHMAP);
+            idebin_put_long(writer, obj->size);
+            break;
+        case IDEOBJ_FUN:
+            idebin_put_tag(writer, IDEBIN_FUN);
+            idebin_put_long(writer, idebin_env_id(writer, obj->env));
+            break;
+        case IDEOBJ_SEQ:
+            idebin_put_tag(writer, IDEBIN_SEQ);
+            idebin_put_long(writer, obj->seq->stage);
+            idebin_put_long(writer, obj->seq->from);
+            idebin_put_long(writer, obj->seq->to);
+            idebin_put_long(writer, obj->seq->step);
+            break;
+    }
+}
+
+// Values still having children to write, and the entries of a map in the
+// order they were added
+typedef struct idebin_frame {
+    ideobj* obj;
+    int next;
+    ideslot** entries;
+} idebin_frame;
+
+int idebin_children(ideobj* obj) {
+    switch (obj->type) {
+        case IDEOBJ_SEXPR:
+        case IDEOBJ_QEXPR: return obj->count;
+        case IDEOBJ_HASHMAP: return obj->size * 2;
+        case IDEOBJ_FUN: return 2;
+        case IDEOBJ_SEQ: return 2;
+        default: return 0;
+    }
+}
+
+ideobj* idebin_child(idebin_frame* frame, int i) {
+    ideobj* obj = frame->obj;
+    switch (obj->type) {
+        case IDEOBJ_HASHMAP:
+            return i % 2 ? frame->entries[i / 2]->val : frame->entries[i / 2]->key;
+        case IDEOBJ_FUN:
+            return i == 0 ? obj->params : obj->body;
+        case IDEOBJ_SEQ:
+            return i == 0 ? obj->seq->fn : obj->seq->source;
+        default:
+            return obj->cell[i];
+    }
+}
+
+// Writes obj and everything it holds from an explicit stack, so nesting
+// is only bounded by memory
+void idebin_put_value(idebin_writer* writer, ideobj* obj) {
+    idebin_frame* frames = malloc(sizeof(idebin_frame) * 16);
+    int capacity = 16;
+    int count = 0;
+
+    frames[count++] = (idebin_frame) { obj, 0, NULL };
+    while (count) {
+        idebin_frame* frame = &frames[count - 1];
+        if (frame->obj->type == IDEOBJ_HASHMAP && !frame->entries) {
+            frame->entries = idemap_ordered(frame->obj);
+        }
+
+        if (frame->next == idebin_children(frame->obj)) {
+            idebin_put_obj(writer, frame->obj);
+            free(frame->entries);
+            count--;
+            continue;
+        }
+
+        ideobj* child = idebin_child(frame, frame->next++);
+        if (!child) {
+            idebin_put_tag(writer, IDEBIN_NONE);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            frames = realloc(frames, sizeof(idebin_frame) * capacity);
+        }
+        frames[count++] = (idebin_frame) { child, 0, NULL };
+    }
+    free(frames);
+}
+
+// Writes the records of the envs numbered from `from` on, and of the ones
+// their bindings bring in
+void idebin_put_envs(idebin_writer* writer, int from) {
+    for (int id=from; id<writer->env_count; id++) {
+        ideenv* env = writer->envs[id];
+        idebin_put_tag(writer, IDEBIN_ENV);
+        idebin_put_long(writer, id);
+        idebin_put_long(writer, env->depth);
+        idebin_put_long(writer, idebin_env_id(writer, env->parent));
+        idebin_put_long(writer, idebin_env_id(writer, env->caller));
+
+        for (int i=0; i<env->count; i++) {
+            // The global env starts out with the builtins already bound
+            // in the same order, only rebound ones need a record
+            ideobj* value = env->values[i];
+            if (
+                !env->parent &&
+                value->type == IDEOBJ_BUILTIN &&
+                idebuiltin_named(env->symbols[i]) == value->builtin
+            ) {
+                continue;
+            }
+
+            idebin_put_value(writer, value);
+            idebin_put_tag(writer, IDEBIN_BIND);
+            idebin_put_name(writer, env->symbols[i]);
+        }
+    }
+}
+
+// Flushes what is left to the file, returns 0 if any write failed
+int idebin_writer_free(idebin_writer* writer) {
+    idebin_flush(writer);
+    free(writer->data);
+    free(writer->envs);
+    free(writer->names);
+    free(writer->name_ids);
+    return !writer->failed;
+}
+
+// Reads from data, refilled from file as it runs out when there is one
+typedef struct idebin_reader {
+    char* data;
+    long size;
+    long pos;
+    long capacity;
+    FILE* file;
+    int failed;
+    ideenv** envs;
+    long env_count;
+    ideobj** values;
+    long count;
+    long capacity_values;
+    char** names;
+    long name_count;
+    long name_capacity;
+} idebin_reader;
+
+// Keeps the unread data and appends at least size more from the file
+void idebin_refill(idebin_reader* reader, long size) {
+    reader->size -= reader->pos;
+    if (reader->size) {
+        memmove(reader->data, reader->data + reader->pos, reader->size);
+    }
+    reader->pos = 0;
+
+    if (reader->capacity < size || reader->capacity < IDEBIN_CHUNK) {
+        long capacity = size > IDEBIN_CHUNK ? size : IDEBIN_CHUNK;
+        char* data = realloc(reader->data, capacity);
+        if (!data) {
+            reader->failed = 1;
+            return;
+        }
+        reader->data = data;
+        reader->capacity = capacity;
+    }
+
+    reader->size += fread(
+        reader->data + reader->size, 1,
+        reader->capacity - reader->size,
+        reader->file
+    );
+}
+
+void idebin_get(idebin_reader* reader, void* bytes, long size) {
+    if (
+        !reader->failed && size >= 0 && reader->file &&
+        reader->pos + size > reader->size
+    ) {
+        idebin_refill(reader, size);
+    }
+    if (reader->failed || size < 0 || reader->pos + size > reader->size) {
+        reader->failed = 1;
+        memset(bytes, 0, size > 0 ? size : 0);
+        return;
+    }
+    memcpy(bytes, reader->data + reader->pos, size);
+    reader->pos += size;
+}
+
+long idebin_get_long(idebin_reader* reader) {
+    unsigned long zigzag = 0;
+    for (int shift=0; shift<70; shift+=7) {
+        unsigned char byte = 0;
+        idebin_get(reader, &byte, 1);
+        zigzag |= (unsigned long) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return (long) (zigzag >> 1) ^ -(long) (zigzag & 1);
+        }
+    }
+    reader->failed = 1;
+    return 0;
+}
+
+// Returns the string at the reader's position, free it after use
+char* idebin_get_str(idebin_reader* reader) {
+    long length = idebin_get_long(reader);
+    if (
+        length < 0 || length > (1L << 31) ||
+        (!reader->file && length > reader->size - reader->pos)
+    ) {
+        reader->failed = 1;
+        length = 0;
+    }
+    char* str = malloc(length + 1);
+    idebin_get(reader, str, length);
+    str[reader->failed ? 0 : length] = '\0';
+    return str;
+}
+
+// Returns the interned name numbered at the reader's position, reading it
+// when it is the next new one
+char* idebin_get_name(idebin_reader* reader) {
+    long id = idebin_get_long(reader);
+    if (id >= 0 && id < reader->name_count) {
+        return reader->names[id];
+    }
+    if (id != reader->name_count || reader->failed) {
+        reader->failed = 1;
+        return ideintern("");
+    }
+
+    if (reader->name_count == reader->name_capacity) {
+        reader->name_capacity = reader->name_capacity
+            ? reader->name_capacity * 2
+            : 64;
+        reader->names = realloc(
+            reader->names,
+            sizeof(char*) * reader->name_capacity
+        );
+    }
+    char* str = idebin_get_str(reader);
+    reader->names[reader->name_count++] = ideintern(str);
+    free(str);
+    return reader->names[reader->name_count - 1];
+}
+
+// Returns env numbered id, created empty until its record is read
+ideenv* idebin_env(idebin_reader* reader, long id) {
+    if (id == -1) {
+        return NULL;
+    }
+    // Envs are numbered in the order they are first written
+    if (id < 0 || id > reader->env_count) {
+        reader->failed = 1;
+        return NULL;
+    }
+
+    if (id >= reader->env_count) {
+        long count = id + 1;
+        reader->envs = realloc(reader->envs, sizeof(ideenv*) * count);
+        for (long i=reader->env_count; i<count; i++) {
+            reader->envs[i] = NULL;
+        }
+        reader->env_count = count;
+    }
+    if (!reader->envs[id]) {
+        reader->envs[id] = ideenv_new();
+    }
+    return reader->envs[id];
+}
+
+void idebin_push(idebin_reader* reader, ideobj* value) {
+    if (reader->count == reader->capacity_values) {
+        reader->capacity_values = reader->capacity_values
+            ? reader->capacity_values * 2
+            : 64;
+        reader->values = realloc(
+            reader->values,
+            sizeof(ideobj*) * reader->capacity_values
+        );
+    }
+    reader->values[reader->count++] = value;
+}
+
+// Pops the count values read last, in the order they were read. Only the
+// parts of a sequence may be missing. Sets failed when there aren't
+// count values, the result is only valid otherwise, and may be NULL
+// when count is 0.
+ideobj** idebin_pop(idebin_reader* reader, long count, int missing) {
+    if (reader->failed || count < 0 || count > reader->count) {
+        reader->failed = 1;
+        return NULL;
+    }
+    for (long i=reader->count - count; i<reader->count && !missing; i++) {
+        if (!reader->values[i]) {
+            reader->failed = 1;
+            return NULL;
+        }
+    }
+    reader->count -= count;
+    return &reader->values[reader->count];
+}
+
+// Reads one record onto the value stack, or into env. Returns 0 at the
+// end of the records or when the data is corrupt.
+int idebin_get_record(idebin_reader* reader, ideenv** env) {
+    unsigned char tag = IDEBIN_END;
+    idebin_get(reader, &tag, 1);
+    if (reader->failed) {
+        return 0;
+    }
+
+    ideobj* value = NULL;
+    switch (tag) {
+        case IDEBIN_END:
+            return 0;
+        case IDEBIN_NONE:
+            idebin_push(reader, NULL);
+            return 1;
+        case IDEBIN_NUM:
+            value = ideobj_num(idebin_get_long(reader));
+            break;
+        case IDEBIN_DECIMAL: {
+            double decimal;
+            idebin_get(reader, &decimal, sizeof(double));
+            value = ideobj_decimal(decimal);
+            break;
+        }
+        case IDEBIN_STR:
+        case IDEBIN_ERR: {
+            char* str = idebin_get_str(reader);
+            value = tag == IDEBIN_STR ? ideobj_str(str) : ideobj_err("%s", str);
+            free(str);
+            break;
+        }
+        case IDEBIN_KEYWORD:
+            value = ideobj_keyword(idebin_get_name(reader));
+            break;
+        case IDEBIN_SYMBOL: {
+            value = ideobj_symbol(idebin_get_name(reader));
+            value->depth = idebin_get_long(reader);
+            value->slot = idebin_get_long(reader);
+            if (value->depth < IDEADDR_GLOBAL || value->slot < -1) {
+                reader->failed = 1;
+            }
+            break;
+        }
+        case IDEBIN_BUILTIN: {
+            ibuiltin builtin = idebuiltin_named(idebin_get_name(reader));
+            if (!builtin) {
+                reader->failed = 1;
+                return 0;
+            }
+            value = ideobj_builtin(builtin);
+            break;
+        }
+        case IDEBIN_SEXPR:
+        case IDEBIN_QEXPR: {
+            long count = idebin_get_long(reader);
+            ideobj** cells = idebin_pop(reader, count, 0);
+            if (reader->failed) {
+                return 0;
+            }
+            value = tag == IDEBIN_SEXPR ? ideobj_sexpr() : ideobj_qexpr();
+            for (long i=0; i<count; i++) {
+                ideobj_list_add(value, cells[i]);
+            }
+            break;
+        }
+        case IDEBIN_HASHMAP: {
+            long size = idebin_get_long(reader);
+            if (size < 0 || size > reader->count) {
+                reader->failed = 1;
+                return 0;
+            }
+            ideobj** entries = idebin_pop(reader, size * 2, 0);
+            if (reader->failed) {
+                return 0;
+            }
+            value = ideobj_hashmap();
+            for (long i=0; i<size; i++) {
+                value = ideobj_hashmap_add(value, entries[i * 2], entries[i * 2 + 1]);
+            }
+            break;
+        }
+        case IDEBIN_FUN: {
+            ideenv* fun_env = idebin_env(reader, idebin_get_long(reader));
+            if (!fun_env) {
+                reader->failed = 1;
+                return 0;
+            }
+            ideobj** parts = idebin_pop(reader, 2, 0);
+            if (reader->failed) {
+                return 0;
+            }
+            if (parts[0]->type != IDEOBJ_QEXPR) {
+                ideobj_del(parts[0]);
+                ideobj_del(parts[1]);
+                reader->failed = 1;
+                return 0;
+            }
+            value = ideobj_new(IDEOBJ_FUN);
+            value->env = ideenv_retain(fun_env);
+            value->params = parts[0];
+            value->body = parts[1];
+            break;
+        }
+        case IDEBIN_SEQ: {
+            long stage = idebin_get_long(reader);
+            long from = idebin_get_long(reader);
+            long to = idebin_get_long(reader);
+            long step = idebin_get_long(reader);
+            if (stage < IDESEQ_RANGE || stage > IDESEQ_DROP) {
+                reader->failed = 1;
+                return 0;
+            }
+            ideobj** parts = idebin_pop(reader, 2, 1);
+            if (reader->failed) {
+                return 0;
+            }
+            value = ideobj_seq(stage, parts[0], parts[1]);
+            value->seq->from = from;
+            value->seq->to = to;
+            value->seq->step = step;
+            break;
+        }
+        case IDEBIN_ENV: {
+            *env = idebin_env(reader, idebin_get_long(reader));
+            long depth = idebin_get_long(reader);
+            ideenv* parent = idebin_env(reader, idebin_get_long(reader));
+            ideenv* caller = idebin_env(reader, idebin_get_long(reader));
+            if (!*env || reader->failed) {
+                reader->failed = 1;
+                return 0;
+            }
+            (*env)->depth = depth;
+            if (parent && !(*env)->parent) {
+                (*env)->parent = ideenv_retain(parent);
+            }
+            if (caller && !(*env)->caller) {
+                (*env)->caller = ideenv_retain(caller);
+            }
+            return 1;
+        }
+        case IDEBIN_BIND: {
+            ideobj* key = ideobj_symbol(idebin_get_name(reader));
+            ideobj** bound = idebin_pop(reader, *env ? 1 : -1, 0);
+            if (reader->failed) {
+                ideobj_del(key);
+                reader->failed = 1;
+                return 0;
+            }
+            ideenv_put(*env, key, bound[0]);
+            ideobj_del(key);
+            ideobj_del(bound[0]);
+            return 1;
+        }
+        default:
+            reader->failed = 1;
+            return 0;
+    }
+
+    if (reader->failed) {
+        ideobj_del(value);
+        return 0;
+    }
+    idebin_push(reader, value);
+    return 1;
+}
+
+// Numbers env next, for records referring to an env that already exists
+void idebin_give_env(idebin_reader* reader, ideenv* env) {
+    reader->envs = realloc(
+        reader->envs,
+        sizeof(ideenv*) * (reader->env_count + 1)
+    );
+    reader->envs[reader->env_count++] = ideenv_retain(env);
+}
+
+// Reads records up to the next end marker. Returns 0 when the data is
+// corrupt, leaving what was read on the stack for idebin_reader_free.
+int idebin_get_records(idebin_reader* reader) {
+    ideenv* env = NULL;
+    while (idebin_get_record(reader, &env));
+    return !reader->failed;
+}
+
+void idebin_reader_free(idebin_reader* reader) {
+    for (long i=0; i<reader->count; i++) {
+        if (reader->values[i]) {
+            ideobj_del(reader->values[i]);
+        }
+    }
+    for (long i=0; i<reader->env_count; i++) {
+        if (reader->envs[i]) {
+            ideenv_del(reader->envs[i]);
+        }
+    }
+    free(reader->values);
+    free(reader->envs);
+    free(reader->names);
+    free(reader->data);
+}
+
+// Encoded files start with a header naming what they hold and the build
+// that wrote them, and for a load cache the hash of its source
+typedef struct idebin_header {
+    char magic[16];
+    long long_size;
+    long double_size;
+    long builtins;
+    unsigned long hash;
+} idebin_header;
+
+idebin_header idebin_header_new(char* magic, unsigned long hash) {
+    idebin_header header = {
+        "", sizeof(long), sizeof(double), idebuiltins.count, hash
+    };
+    memcpy(header.magic, magic, strlen(magic));
+    return header;
+}
+
+// Starts reading file, returns 0 unless it begins with header
+int idebin_open(idebin_reader* reader, FILE* file, idebin_header header) {
+    *reader = (idebin_reader) { 0 };
+    reader->file = file;
+
+    idebin_header found;
+    idebin_get(reader, &found, sizeof(found));
+    return !reader->failed && memcmp(&found, &header, sizeof(header)) == 0;
+}
+
+#define IDEIMAGE_MAGIC "IdeLISP image 2"
+
+// Writes the global env and everything reachable from it to path
+ideobj* ideimage_dump(ideenv* env, char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return ideobj_err("Could not write image %s", path);
+    }
+
+    idebin_writer writer = { 0 };
+    writer.file = file;
+    idebin_header header = idebin_header_new(IDEIMAGE_MAGIC, 0);
+    idebin_put(&writer, &header, sizeof(header));
+
+    idebin_env_id(&writer, ideenv_global(env));
+    idebin_put_envs(&writer, 0);
+    idebin_put_tag(&writer, IDEBIN_END);
+
+    int written = idebin_writer_free(&writer);
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        return ideobj_err("Could not write image %s", path);
+    }
+    return ideobj_sexpr();
+}
+
+// Binds the global env of an image into env, whose builtins must be the
+// ones of the build that wrote it
+ideobj* ideimage_load(ideenv* env, char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return ideobj_err(
+            "Could not load image %s, reason Unable to open file!", path
+        );
+    }
+
+    idebin_reader reader;
+    if (!idebin_open(&reader, file, idebin_header_new(IDEIMAGE_MAGIC, 0))) {
+        idebin_reader_free(&reader);
+        fclose(file);
+        return ideobj_err(
+            "Could not load image %s, reason Not an image of this build", path
+        );
+    }
+
+    idebin_give_env(&reader, ideenv_global(env));
+    int read = idebin_get_records(&reader) && reader.count == 0;
+    idebin_reader_free(&reader);
+    fclose(file);
+
+    if (!read) {
+        return ideobj_err("Could not load image %s, reason Corrupt image", path);
+    }
+    return ideobj_sexpr();
+}
+
+// Loading keeps a cache next to each file, holding the expressions read
+// from it, keyed by a hash of the source. Later loads of the same source
+// decode the cache instead of reading the text. --no-cache turns it off.
+#define IDELOAD_MAGIC "IdeLISP cache 1"
+
+int ideload_cache = 1;
+
+// Returns the cache path of path, with its .ilisp extension replaced by
+// .ilc or .ilc appended. Free it after use.
+char* ideload_cache_path(char* path) {
+    long length = strlen(path);
+    char* extension = ".ilisp";
+    long extension_length = strlen(extension);
+    if (
+        length > extension_length &&
+        strcmp(path + length - extension_length, extension) == 0
+    ) {
+        length -= extension_length;
+    }
+
+    char* cache_path = malloc(length + strlen(".ilc") + 1);
+    memcpy(cache_path, path, length);
+    strcpy(cache_path + length, ".ilc");
+    return cache_path;
+}
+
+// Hashes the rest of file and rewinds it
+unsigned long ideload_hash(FILE* file) {
+    unsigned long hash = 14695981039346656037UL;
+    unsigned char chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        for (size_t i=0; i<read; i++) {
+            hash ^= chunk[i];
+            hash *= 1099511628211UL;
+        }
+    }
+    rewind(file);
+    return hash;
+}
+
+// Evaluates one loaded expression, returning the error if it failed
+ideobj* ideload_eval(ideenv* env, ideobj* expression) {
+    expression = ideobj_eval(env, expression);
+    idegc_safepoint();
+    if (expression->type == IDEOBJ_ERR) {
+        return expression;
+    }
+    ideobj_del(expression);
+    return NULL;
+}
+
+// Reads and evaluates the source in file one top-level expression at a
+// time, so only the one being evaluated is held in memory. Each one is
+// also written to cache before it is evaluated, when there is one.
+ideobj* ideload_source(
+    ideenv* env, char* path, FILE* file, idebin_writer* cache
+) {
+    int from_stdin = file == stdin;
+    idereader reader = ideread_open(from_stdin ? "<stdin>" : path, file);
+    ideobj* result = NULL;
+
+    idegc_push(env);
+    ideobj* expression;
+    while (!result && (expression = ideread_next(&reader))) {
+        if (reader.failed) {
+            result = ideobj_err(
+                "Could not load module %s, reason %s",
+                path,
+                expression->err
+            );
+            ideobj_del(expression);
+            break;
+        }
+
+        if (cache) {
+            idebin_put_value(cache, expression);
+            idebin_put_tag(cache, IDEBIN_END);
+        }
+        result = ideload_eval(env, expression);
+    }
+    idegc_pop();
+
+    free(reader.source);
+    return result;
+}
+
+// Evaluates the expressions in a cache of the source hashed to hash.
+// Returns NULL, before evaluating anything, when it is a cache of some
+// other source or build.
+ideobj* ideload_cached(ideenv* env, char* path, FILE* file, unsigned long hash) {
+    idebin_reader reader;
+    if (!idebin_open(&reader, file, idebin_header_new(IDELOAD_MAGIC, hash))) {
+        idebin_reader_free(&reader);
+        return NULL;
+    }
+
+    ideobj* result = NULL;
+    idegc_push(env);
+    while (!result) {
+        if (!idebin_get_records(&reader) || reader.count > 1) {
+            result = ideobj_err(
+                "Could not load module %s, reason Corrupt cache", path
+            );
+            break;
+        }
+        if (reader.count == 0) {
+            break;
+        }
+        result = ideload_eval(env, reader.values[--reader.count]);
+    }
+    idegc_pop();
+
+    idebin_reader_free(&reader);
+    return result ? result : ideobj_sexpr();
+}
+
+// Loads the source in file, through its cache when it has one that is
+// current, writing a new one when it doesn't
+ideobj* ideload(ideenv* env, char* path, FILE* file) {
+    if (file == stdin || !ideload_cache) {
+        ideobj* result = ideload_source(env, path, file, NULL);
+        return result ? result : ideobj_sexpr();
+    }
+
+    unsigned long hash = ideload_hash(file);
+    char* cache_path = ideload_cache_path(path);
+
+    FILE* cached = fopen(cache_path, "rb");
+    if (cached) {
+        ideobj* result = ideload_cached(env, path, cached, hash);
+        fclose(cached);
+        if (result) {
+            free(cache_path);
+            return result;
+        }
+    }
+
+    // The cache is written beside it and moved into place once complete,
+    // so a failed or concurrent load never leaves half of one behind
+    char* tmp_path = malloc(strlen(cache_path) + strlen(".tmp") + 1);
+    sprintf(tmp_path, "%s.tmp", cache_path);
+
+    idebin_writer writer = { 0 };
+    writer.file = fopen(tmp_path, "wb");
+    if (writer.file) {
+        idebin_header header = idebin_header_new(IDELOAD_MAGIC, hash);
+        idebin_put(&writer, &header, sizeof(header));
+    }
+
+    ideobj* result = ideload_source(
+        env, path, file, writer.file ? &writer : NULL
+    );
+
+    if (writer.file) {
+        idebin_put_tag(&writer, IDEBIN_END);
+        FILE* written = writer.file;
+        int complete = idebin_writer_free(&writer);
+        complete = fclose(written) == 0 && complete && !result;
+        if (!complete || rename(tmp_path, cache_path) != 0) {
+            remove(tmp_path);
+        }
+    }
+
+    free(tmp_path);
+    free(cache_path);
+    return result ? result : ideobj_sexpr();
+}
+
+#define IDEDATA_MAGIC "IdeLISP data 1"
+
+// Writes a value to a file in the binary encoding, "-" writes to stdout.
+// Functions keep referring to the global env of whoever reads them back.
+ideobj* builtin_serialize(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("serialize", obj, 2);
+    IASSERT_TYPE("serialize", obj, 1, IDEOBJ_STR);
+
+    char* path = obj->cell[1]->str;
+    int to_stdout = strcmp(path, "-") == 0;
+    FILE* file = to_stdout ? stdout : fopen(path, "wb");
+    IASSERT(obj, file, "Could not serialize to %s", path);
+
+    idebin_writer writer = { 0 };
+    writer.file = file;
+    idebin_header header = idebin_header_new(IDEDATA_MAGIC, 0);
+    idebin_put(&writer, &header, sizeof(header));
+
+    idebin_env_id(&writer, ideenv_global(env));
+    idebin_put_value(&writer, obj->cell[0]);
+    idebin_put_envs(&writer, 1);
+    idebin_put_tag(&writer, IDEBIN_END);
+
+    int written = idebin_writer_free(&writer);
+    written = (to_stdout ? fflush(file) : fclose(file)) == 0 && written;
+    IASSERT(obj, written, "Could not serialize to %s", path);
+
+    ideobj_del(obj);
+    return ideobj_sexpr();
+}
+
+// Reads back a value written by serialize, "-" reads from stdin
+ideobj* builtin_deserialize(ideenv* env, ideobj* obj) {
+    IASSERT_NUM("deserialize", obj, 1);
+    IASSERT_TYPE("deserialize", obj, 0, IDEOBJ_STR);
+
+    char* path = obj->cell[0]->str;
+    int from_stdin = strcmp(path, "-") == 0;
+    FILE* file = from_stdin ? stdin : fopen(path, "rb");
+    IASSERT(
+        obj, file,
+        "Could not deserialize %s, reason Unable to open file!", path
+    );
+
+    idebin_reader reader;
+    int read = idebin_open(&reader, file, idebin_header_new(IDEDATA_MAGIC, 0));
+    if (read) {
+        idebin_give_env(&reader, ideenv_global(env));
+        read = idebin_get_records(&reader) && reader.count == 1;
+    }
+
+    ideobj* value = read
+        ? reader.values[--reader.count]
+        : ideobj_err("Could not deserialize %s, reason Corrupt data", path);
+
+    idebin_reader_free(&reader);
+    if (!from_stdin) {
+        fclose(file);
+    }
+    ideobj_del(obj);
+    return value;
+}
+
+void ideenv_add_builtin(ideenv* env, char* name, ibuiltin fn) {
+    idebuiltin_register(name, fn);
+
     ideobj *key = ideobj_symbol(name);
     ideobj *fun = ideobj_builtin(fn);
 
@@ -1838,8 +7025,22 @@ void ideenv_add_builtins(ideenv* env) {
     // List
     ideenv_add_builtin(env, "head", builtin_head);
     ideenv_add_builtin(env, "tail", builtin_tail);
+    ideenv_add_builtin(env, "nth", builtin_nth);
     ideenv_add_builtin(env, "list", builtin_list);
     ideenv_add_builtin(env, "join", builtin_join);
+    ideenv_add_builtin(env, "map", builtin_map);
+    ideenv_add_builtin(env, "filter", builtin_filter);
+    ideenv_add_builtin(env, "foldl", builtin_foldl);
+    ideenv_add_builtin(env, "last", builtin_last);
+    ideenv_add_builtin(env, "take", builtin_take);
+    ideenv_add_builtin(env, "drop", builtin_drop);
+    ideenv_add_builtin(env, "zip", builtin_zip);
+    ideenv_add_builtin(env, "elem", builtin_elem);
+    ideenv_add_builtin(env, "flatten", builtin_flatten);
+
+    // Sequence
+    ideenv_add_builtin(env, "range", builtin_range);
+    ideenv_add_builtin(env, "take-while", builtin_take_while);
 
     // Expression
     ideenv_add_builtin(env, "eval", builtin_eval);
@@ -1853,9 +7054,14 @@ void ideenv_add_builtins(ideenv* env) {
     ideenv_add_builtin(env, "exit", builtin_exit);
     ideenv_add_builtin(env, "print", builtin_print);
     ideenv_add_builtin(env, "load", builtin_load);
+    ideenv_add_builtin(env, "reload", builtin_reload);
+    ideenv_add_builtin(env, "serialize", builtin_serialize);
+    ideenv_add_builtin(env, "deserialize", builtin_deserialize);
     ideenv_add_builtin(env, "error", builtin_error);
     ideenv_add_builtin(env, "type", builtin_type);
     ideenv_add_builtin(env, "len", builtin_len);
+    ideenv_add_builtin(env, "alloc-stats", builtin_alloc_stats);
+    ideenv_add_builtin(env, "gc-stats", builtin_gc_stats);
 
     // Functions
     ideenv_add_builtin(env, "fn", builtin_fn);
@@ -1865,6 +7071,7 @@ void ideenv_add_builtins(ideenv* env) {
     ideenv_add_builtin(env, "concat", builtin_concat);
     ideenv_add_builtin(env, "str-split", builtin_str_split);
     ideenv_add_builtin(env, "str", builtin_str);
+    ideenv_add_builtin(env, "str-join", builtin_str_join);
     ideenv_add_builtin(env, "upper-case", builtin_str_uppercase);
     ideenv_add_builtin(env, "lower-case", builtin_str_lowercase);
 
@@ -1883,6 +7090,8 @@ void ideenv_add_builtins(ideenv* env) {
     ideenv_add_builtin(env, "^", builtin_pow);
     ideenv_add_builtin(env, "min", builtin_min);
     ideenv_add_builtin(env, "max", builtin_max);
+    ideenv_add_builtin(env, "sum", builtin_sum);
+    ideenv_add_builtin(env, "product", builtin_product);
 
     // Comparisions
     ideenv_add_builtin(env, ">", builtin_gt);
@@ -1897,6 +7106,8 @@ void ideenv_add_builtins(ideenv* env) {
 
     // Conditionals
     ideenv_add_builtin(env, "if", builtin_if);
+    ideenv_add_builtin(env, "cond", builtin_cond);
+    ideenv_add_builtin(env, "case", builtin_case);
 
     // Keyword
     ideenv_add_builtin(env, "keyword", builtin_keyword);
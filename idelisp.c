@@ -1,11 +1,47 @@
 #include "core.c"
 #include <editline/readline.h>
+#include <sys/resource.h>
 
 enum { RUNMODE_REPL, RUNMODE_FILE };
 
+#if defined(__SANITIZE_ADDRESS__)
+#define IDE_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define IDE_SANITIZED
+#endif
+#endif
+
 int main(int argc, char** argv) {
     int run_mode = RUNMODE_REPL;
     char* source_file = NULL;
+    char* image_file = NULL;
+    char* dump_file = NULL;
+
+    // Nesting may use the main thread's stack up to a megabyte short of
+    // its limit, unoptimized builds take close to a kilobyte per level
+    struct rlimit stack;
+
+#ifdef IDE_SANITIZED
+    // Sanitizer builds take a few times more stack per level, so they
+    // raise the limit as far as allowed to nest as deep as other builds.
+    // The main thread's stack grows up to the limit in force at the time.
+    if (getrlimit(RLIMIT_STACK, &stack) == 0
+        && stack.rlim_cur != RLIM_INFINITY) {
+        rlim_t wanted = stack.rlim_cur * 4;
+        if (stack.rlim_max != RLIM_INFINITY && wanted > stack.rlim_max) {
+            wanted = stack.rlim_max;
+        }
+        stack.rlim_cur = wanted;
+        setrlimit(RLIMIT_STACK, &stack);
+    }
+#endif
+
+    if (getrlimit(RLIMIT_STACK, &stack) == 0
+        && stack.rlim_cur != RLIM_INFINITY
+        && (long) stack.rlim_cur - (1L << 20) > idedepth_max_stack) {
+        idedepth_max_stack = (long) stack.rlim_cur - (1L << 20);
+    }
 
     for (int i=0; i<argc; i++) {
         if (strcmp(argv[i], "-f") == 0 && i<argc-1) {
@@ -13,50 +49,57 @@ int main(int argc, char** argv) {
             run_mode = RUNMODE_FILE;
             i++;
         }
-    }
 
-    Decimal = mpc_new("decimal");
-    Number = mpc_new("number");
-    String = mpc_new("string");
-    Symbol = mpc_new("symbol");
-    Keyword = mpc_new("keyword");
-    Comment = mpc_new("comment");
-    HashMap = mpc_new("hashmap");
-    Sexpr = mpc_new("sexpr");
-    Qexpr = mpc_new("qexpr");
-    Expr = mpc_new("expr");
-    IdeLISP = mpc_new("idelisp");
-
-    mpca_lang(MPCA_LANG_DEFAULT,
-        "                                                                     \
-            decimal  : /-?[0-9]+\\.[0-9]+/ ;                                  \
-            number   : /-?[0-9]+/ ;                                           \
-            string   : /\"(\\\\.|[^\"])*\"/ ;                                 \
-            keyword  : /:[a-zA-Z0-9_+^\\-*\\/\\\\=<>!&%\\?]+/ ;               \
-            symbol   : /[a-zA-Z0-9_+^\\-*\\/\\\\=<>!&%\\?]+/ ;                \
-            comment  : /;[^\\r\\n]*/ ;                                        \
-            hashmap  : '{' <expr>* '}' ;                                      \
-            sexpr    : '(' <expr>* ')' ;                                      \
-            qexpr    : \"'(\" <expr>* ')' ;                                   \
-            expr     : <decimal> | <number> | <string> | <keyword> | <symbol> \
-                     | <sexpr> | <qexpr> | <comment> | <hashmap> ;            \
-            idelisp  : /^/ <expr>* /$/ ;                                      \
-        ",
-        Decimal,
-        Number,
-        String,
-        Keyword,
-        Symbol,
-        Comment,
-        HashMap,
-        Sexpr,
-        Qexpr,
-        Expr,
-        IdeLISP);
+        // Evaluate function bodies with the tree-walker instead of the
+        // bytecode VM, to check one against the other
+        if (strcmp(argv[i], "--tree-walk") == 0) {
+            idevm_enabled = 0;
+        }
+
+        if (strcmp(argv[i], "--max-depth") == 0 && i<argc-1) {
+            idedepth_max_frames = atol(argv[i+1]);
+            i++;
+        }
+
+        // Start from the globals saved in an image instead of only the
+        // builtins, see ideimage_load
+        if (strcmp(argv[i], "--image") == 0 && i<argc-1) {
+            image_file = argv[i+1];
+            i++;
+        }
+
+        // Always read source files, without writing caches of them
+        if (strcmp(argv[i], "--no-cache") == 0) {
+            ideload_cache = 0;
+        }
+
+        // Search DIR for modules that aren't found from the working
+        // directory, see idemodule_open
+        if (strcmp(argv[i], "--path") == 0 && i<argc-1) {
+            idepath_add(&idemodule_dirs, argv[i+1]);
+            i++;
+        }
+
+        // Save the globals to an image after the file has run
+        if (strcmp(argv[i], "--dump-image") == 0 && i<argc-1) {
+            dump_file = argv[i+1];
+            i++;
+        }
+    }
 
     ideenv* env = ideenv_new();
     env->depth = 0;
     ideenv_add_builtins(env);
+    idegc_push(env);
+
+    if (image_file) {
+        ideobj* image = ideimage_load(env, image_file);
+        if (image->type == IDEOBJ_ERR) {
+            ideobj_println(image);
+            return 1;
+        }
+        ideobj_del(image);
+    }
 
     if (run_mode == RUNMODE_FILE) {
         ideobj* args = ideobj_list_add(ideobj_sexpr(), ideobj_str(source_file));
@@ -67,6 +110,19 @@ int main(int argc, char** argv) {
             return 1;
         }
         ideobj_del(expression);
+    }
+
+    if (dump_file) {
+        ideobj* image = ideimage_dump(env, dump_file);
+        if (image->type == IDEOBJ_ERR) {
+            ideobj_println(image);
+            return 1;
+        }
+        ideobj_del(image);
+        return 0;
+    }
+
+    if (run_mode == RUNMODE_FILE) {
         return 0;
     }
 
@@ -75,39 +131,21 @@ int main(int argc, char** argv) {
         char* source = readline(">> ");
         add_history(source);
 
-        mpc_result_t result;
-        if (mpc_parse("<stdin>", source, IdeLISP, &result)) {
-            mpc_ast_t* root_node = result.output;
-
-            ideobj* v = ideobj_eval(
-                env,
-                ideobj_read(root_node)
-            );
+        ideobj* expressions = ideobj_read("<stdin>", source);
+        if (expressions->type != IDEOBJ_ERR) {
+            ideobj* v = ideobj_realize(env, ideobj_eval(env, expressions));
             ideobj_println(v);
             ideobj_del(v);
+            idegc_safepoint();
         } else {
-            mpc_err_print(result.error);
+            puts(expressions->err);
+            ideobj_del(expressions);
         }
-        mpc_ast_delete(result.output);
 
         free(source);
     }
 
     ideenv_del(env);
 
-    mpc_cleanup(
-        11,
-        Decimal,
-        Number,
-        String,
-        Keyword,
-        Symbol,
-        Comment,
-        HashMap,
-        Sexpr,
-        Qexpr,
-        Expr,
-        IdeLISP
-    );
     return 0;
 }